@@ -0,0 +1,315 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <cstdint>
+
+// Concurrent priority queue built as a relaxed multi queue.
+//
+// Elements are spread over several binary heaps, each protected by its own mutex. A push locks one heap that is
+// not currently locked by anyone else and inserts there. A pop looks at two heaps picked at random and removes
+// the better of their tops. Threads therefore rarely wait on the same lock, at the cost of strict ordering:
+// a pop returns one of the highest priority elements with high probability, but not necessarily the highest.
+//
+// An atomic element count is reserved before a pop starts searching, so a pop that got a reservation always
+// finds an element and a pop never reports the queue as empty while it holds elements.
+template <typename T, typename TCompare = std::less<T>>
+class ConcurrentPriorityQueue
+{
+public:
+	// Use 'numHeaps' heaps, or twice the number of hardware threads if zero. At least two heaps are always used.
+	explicit ConcurrentPriorityQueue(size_t numHeaps = 0, const TCompare& compare = TCompare());
+	~ConcurrentPriorityQueue() = default;
+
+	ConcurrentPriorityQueue(const ConcurrentPriorityQueue<T, TCompare>& other) = delete;
+	ConcurrentPriorityQueue<T, TCompare>& operator=(const ConcurrentPriorityQueue<T, TCompare>& other) = delete;
+
+	ConcurrentPriorityQueue(ConcurrentPriorityQueue<T, TCompare>&& other) = delete;
+	ConcurrentPriorityQueue<T, TCompare>& operator=(ConcurrentPriorityQueue<T, TCompare>&& other) = delete;
+
+	void Push(const T& value);
+	void Push(T&& value);
+
+	std::shared_ptr<T> TryPop();
+	bool TryPop(T& result);
+
+	std::shared_ptr<T> WaitAndPop();
+	bool WaitAndPop(T& result);
+
+	// Lock free. Exact when no other thread is pushing or popping.
+	size_t SizeApprox() const;
+	bool Empty() const;
+
+private:
+	struct Heap
+	{
+		std::mutex mutex;
+		std::vector<T> elements;
+	};
+
+	// Number of two choice attempts a pop makes before it falls back to visiting every heap in turn.
+	enum : size_t { TwoChoiceAttempts = 4 };
+
+	// Number of attempts a waiting pop makes before it parks on the condition variable.
+	enum : size_t { SpinCount = 64 };
+
+	template<typename TValue>
+	void PushValue(TValue&& value);
+
+	// Claim one element of the count. Return false if the count is zero.
+	bool TryReserve();
+
+	// Claim one element of the count, parking until there is one.
+	void WaitAndReserve();
+
+	// Remove an element for a pop that holds a reservation.
+	T PopReserved();
+
+	// Remove the top of 'heap'. The heap's lock must be held and the heap must not be empty.
+	T PopTop(Heap& heap);
+
+	size_t RandomHeapIndex();
+
+private:
+	std::unique_ptr<Heap[]> m_heaps;
+	size_t m_numHeaps;
+	TCompare m_compare;
+
+	// Number of elements that are in a heap and not reserved by a pop.
+	std::atomic<size_t> m_size;
+
+	// Only used to park and wake waiting pops.
+	std::mutex m_waitMutex;
+	std::condition_variable m_notEmptyCondition;
+	std::atomic<size_t> m_sleepingWaiters;
+};
+
+template<typename T, typename TCompare>
+inline ConcurrentPriorityQueue<T, TCompare>::ConcurrentPriorityQueue(size_t numHeaps, const TCompare& compare) :
+	m_heaps(nullptr), m_numHeaps(numHeaps), m_compare(compare), m_size(0), m_sleepingWaiters(0)
+{
+	if (m_numHeaps == 0)
+	{
+		m_numHeaps = 2 * std::thread::hardware_concurrency();
+	}
+
+	// A pop compares two different heaps.
+	m_numHeaps = std::max<size_t>(2, m_numHeaps);
+
+	m_heaps.reset(new Heap[m_numHeaps]);
+}
+
+template<typename T, typename TCompare>
+inline void ConcurrentPriorityQueue<T, TCompare>::Push(const T& value)
+{
+	PushValue(value);
+}
+
+template<typename T, typename TCompare>
+inline void ConcurrentPriorityQueue<T, TCompare>::Push(T&& value)
+{
+	PushValue(std::move(value));
+}
+
+template<typename T, typename TCompare>
+inline std::shared_ptr<T> ConcurrentPriorityQueue<T, TCompare>::TryPop()
+{
+	if (!TryReserve())
+	{
+		return std::shared_ptr<T>();
+	}
+
+	return std::make_shared<T>(PopReserved());
+}
+
+template<typename T, typename TCompare>
+inline bool ConcurrentPriorityQueue<T, TCompare>::TryPop(T& result)
+{
+	if (!TryReserve())
+	{
+		return false;
+	}
+
+	result = PopReserved();
+	return true;
+}
+
+template<typename T, typename TCompare>
+inline std::shared_ptr<T> ConcurrentPriorityQueue<T, TCompare>::WaitAndPop()
+{
+	WaitAndReserve();
+	return std::make_shared<T>(PopReserved());
+}
+
+template<typename T, typename TCompare>
+inline bool ConcurrentPriorityQueue<T, TCompare>::WaitAndPop(T& result)
+{
+	WaitAndReserve();
+	result = PopReserved();
+	return true;
+}
+
+template<typename T, typename TCompare>
+inline size_t ConcurrentPriorityQueue<T, TCompare>::SizeApprox() const
+{
+	return m_size.load();
+}
+
+template<typename T, typename TCompare>
+inline bool ConcurrentPriorityQueue<T, TCompare>::Empty() const
+{
+	return m_size.load() == 0;
+}
+
+template<typename T, typename TCompare>
+template<typename TValue>
+inline void ConcurrentPriorityQueue<T, TCompare>::PushValue(TValue&& value)
+{
+	// Prefer a heap nobody else is using, but do not search forever.
+	size_t index = RandomHeapIndex();
+	std::unique_lock<std::mutex> heapLock(m_heaps[index].mutex, std::try_to_lock);
+	for (size_t attempt = 0; !heapLock.owns_lock() && attempt < m_numHeaps; ++attempt)
+	{
+		index = RandomHeapIndex();
+		heapLock = std::unique_lock<std::mutex>(m_heaps[index].mutex, std::try_to_lock);
+	}
+	if (!heapLock.owns_lock())
+	{
+		heapLock.lock();
+	}
+
+	std::vector<T>& elements = m_heaps[index].elements;
+	elements.push_back(std::forward<TValue>(value));
+	std::push_heap(elements.begin(), elements.end(), m_compare);
+	heapLock.unlock();
+
+	// Only count the element once it can be found.
+	++m_size;
+
+	// A waiter that registered as sleeping holds the wait lock until it is parked, so taking the wait lock
+	// before notifying guarantees that the notification cannot slip in between its check and its wait.
+	if (m_sleepingWaiters.load() != 0)
+	{
+		{
+			std::lock_guard<std::mutex> waitLock(m_waitMutex);
+		}
+		m_notEmptyCondition.notify_one();
+	}
+}
+
+template<typename T, typename TCompare>
+inline bool ConcurrentPriorityQueue<T, TCompare>::TryReserve()
+{
+	size_t size = m_size.load();
+
+	// If the exchange fails size will be updated to the current count.
+	while (size != 0)
+	{
+		if (m_size.compare_exchange_weak(size, size - 1))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+template<typename T, typename TCompare>
+inline void ConcurrentPriorityQueue<T, TCompare>::WaitAndReserve()
+{
+	// An element often arrives shortly after the queue runs dry, so try a few times before paying for parking.
+	for (size_t i = 0; i < SpinCount; ++i)
+	{
+		if (TryReserve())
+		{
+			return;
+		}
+	}
+
+	std::unique_lock<std::mutex> waitLock(m_waitMutex);
+
+	// Register before the predicate is first checked. Both the registration and the count are sequentially
+	// consistent, so either the check sees a concurrent push or that push sees the registration.
+	++m_sleepingWaiters;
+	m_notEmptyCondition.wait(waitLock, [&]() -> bool { return TryReserve(); });
+	--m_sleepingWaiters;
+}
+
+template<typename T, typename TCompare>
+inline T ConcurrentPriorityQueue<T, TCompare>::PopReserved()
+{
+	// Elements are only removed by pops holding a reservation, so the heaps hold at least as many elements as
+	// there are outstanding reservations and the search below always ends.
+	while (true)
+	{
+		for (size_t attempt = 0; attempt < TwoChoiceAttempts; ++attempt)
+		{
+			size_t firstIndex = RandomHeapIndex();
+			size_t secondIndex = RandomHeapIndex();
+			if (secondIndex == firstIndex)
+			{
+				secondIndex = (firstIndex + 1) % m_numHeaps;
+			}
+
+			// Never wait on a lock while holding another, pick a different pair instead.
+			std::unique_lock<std::mutex> firstLock(m_heaps[firstIndex].mutex, std::try_to_lock);
+			if (!firstLock.owns_lock())
+			{
+				continue;
+			}
+			std::unique_lock<std::mutex> secondLock(m_heaps[secondIndex].mutex, std::try_to_lock);
+			if (!secondLock.owns_lock())
+			{
+				continue;
+			}
+
+			Heap& first = m_heaps[firstIndex];
+			Heap& second = m_heaps[secondIndex];
+			if (first.elements.empty() && second.elements.empty())
+			{
+				continue;
+			}
+
+			// Take the top that comes first in priority order.
+			bool takeSecond = first.elements.empty() ||
+				(!second.elements.empty() && m_compare(first.elements.front(), second.elements.front()));
+			return PopTop(takeSecond ? second : first);
+		}
+
+		// The random picks keep missing, which happens when few elements are left, so visit every heap in turn.
+		for (size_t index = 0; index < m_numHeaps; ++index)
+		{
+			std::lock_guard<std::mutex> heapLock(m_heaps[index].mutex);
+			if (!m_heaps[index].elements.empty())
+			{
+				return PopTop(m_heaps[index]);
+			}
+		}
+	}
+}
+
+template<typename T, typename TCompare>
+inline T ConcurrentPriorityQueue<T, TCompare>::PopTop(Heap& heap)
+{
+	std::pop_heap(heap.elements.begin(), heap.elements.end(), m_compare);
+	T top(std::move(heap.elements.back()));
+	heap.elements.pop_back();
+	return top;
+}
+
+template<typename T, typename TCompare>
+inline size_t ConcurrentPriorityQueue<T, TCompare>::RandomHeapIndex()
+{
+	// Xorshift, seeded differently on every thread. Quality does not matter, only speed and spread.
+	thread_local uint32_t state = static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state % m_numHeaps;
+}
@@ -0,0 +1,160 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "../Concurrent-Priority-Queue/Source/ConcurrentPriorityQueue.h"
+#include <vector>
+#include <thread>
+#include <future>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace Tests
+{
+	TEST_CLASS(Tests)
+	{
+	public:
+		TEST_METHOD(PushTryPopOrderMethod)
+		{
+			// With two heaps every pop compares the tops of both, so a single thread sees strict priority order.
+			ConcurrentPriorityQueue<int> priorityQueue(2);
+			int integer = -1;
+			Assert::IsFalse(priorityQueue.TryPop(integer));
+			Assert::IsTrue(priorityQueue.TryPop() == nullptr);
+
+			std::vector<int> integersPushed;
+			for (int i = 0; i < 100; ++i)
+			{
+				integersPushed.push_back((i * 37) % 100);
+			}
+			for (int value : integersPushed)
+			{
+				priorityQueue.Push(value);
+			}
+			Assert::AreEqual(integersPushed.size(), priorityQueue.SizeApprox());
+
+			for (int i = 99; i >= 0; i -= 2)
+			{
+				std::shared_ptr<int> integerPtr = priorityQueue.TryPop();
+				Assert::IsTrue(integerPtr != nullptr && *integerPtr == i);
+				Assert::IsTrue(priorityQueue.TryPop(integer));
+				Assert::AreEqual(i - 1, integer);
+			}
+			Assert::IsTrue(priorityQueue.Empty());
+		}
+
+		TEST_METHOD(CustomCompareMethod)
+		{
+			// A greater than comparison turns the queue into a min queue.
+			ConcurrentPriorityQueue<int, std::greater<int>> priorityQueue(2);
+			priorityQueue.Push(3);
+			priorityQueue.Push(1);
+			priorityQueue.Push(2);
+
+			int integer = -1;
+			for (int expected = 1; expected <= 3; ++expected)
+			{
+				Assert::IsTrue(priorityQueue.WaitAndPop(integer));
+				Assert::AreEqual(expected, integer);
+			}
+		}
+
+		TEST_METHOD(ContendedPushAndPopMethod)
+		{
+			size_t numProducers = 4;
+			size_t numConsumers = 4;
+			int numIntegersPerProducer = 5000;
+
+			ConcurrentPriorityQueue<int> priorityQueue;
+			std::vector<std::future<void>> producers;
+			std::vector<std::future<std::vector<int>>> consumers;
+
+			for (size_t i = 0; i < numProducers; ++i)
+			{
+				producers.push_back(std::async(std::launch::async, [&, i]() -> void
+				{
+					for (int j = 0; j < numIntegersPerProducer; ++j)
+					{
+						priorityQueue.Push(static_cast<int>(i) * numIntegersPerProducer + j);
+					}
+				}));
+			}
+
+			// Half of the consumers poll and half of them wait.
+			for (size_t i = 0; i < numConsumers; ++i)
+			{
+				consumers.push_back(std::async(std::launch::async, [&, i]() -> std::vector<int>
+				{
+					std::vector<int> integersPoped;
+					int integer;
+					while (integersPoped.size() < numProducers * numIntegersPerProducer / numConsumers)
+					{
+						if (i % 2 == 0)
+						{
+							if (priorityQueue.TryPop(integer))
+							{
+								integersPoped.push_back(integer);
+							}
+						}
+						else
+						{
+							integersPoped.push_back(*priorityQueue.WaitAndPop());
+						}
+					}
+					return integersPoped;
+				}));
+			}
+
+			for (std::future<void>& producer : producers)
+			{
+				producer.get();
+			}
+
+			// Every integer was popped exactly once.
+			std::vector<int> integersPoped;
+			for (std::future<std::vector<int>>& consumer : consumers)
+			{
+				std::vector<int> consumed = consumer.get();
+				integersPoped.insert(integersPoped.end(), consumed.begin(), consumed.end());
+			}
+
+			std::sort(integersPoped.begin(), integersPoped.end());
+			Assert::AreEqual(numProducers * numIntegersPerProducer, integersPoped.size());
+			for (size_t i = 0; i < integersPoped.size(); ++i)
+			{
+				Assert::AreEqual(static_cast<int>(i), integersPoped[i]);
+			}
+			Assert::IsTrue(priorityQueue.Empty());
+		}
+
+		TEST_METHOD(ParkedWaitersWakeOnPushMethod)
+		{
+			size_t numWaiters = 4;
+
+			ConcurrentPriorityQueue<int> priorityQueue;
+			std::vector<std::future<std::shared_ptr<int>>> futures;
+
+			// Launch all waiting threads and give them time to spin out and park.
+			for (size_t i = 0; i < numWaiters; ++i)
+			{
+				futures.push_back(std::async(std::launch::async, [&]() -> std::shared_ptr<int> { return priorityQueue.WaitAndPop(); }));
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+			for (size_t i = 0; i < numWaiters; ++i)
+			{
+				priorityQueue.Push(static_cast<int>(i));
+			}
+
+			// Every waiter receives exactly one integer.
+			std::vector<int> integersPoped;
+			for (std::future<std::shared_ptr<int>>& future : futures)
+			{
+				integersPoped.push_back(*(future.get()));
+			}
+			std::sort(integersPoped.begin(), integersPoped.end());
+			Assert::IsTrue(integersPoped == std::vector<int>({ 0, 1, 2, 3 }));
+		}
+	};
+}
@@ -1,12 +1,46 @@
 #pragma once
 #include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <optional>
+#include <utility>
+#include <type_traits>
+#include <new>
+
+// Awaitable pops need C++20 coroutines.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define CONCURRENT_QUEUE_COROUTINES 1
+#else
+#define CONCURRENT_QUEUE_COROUTINES 0
+#endif
+
+// Readiness notification through an eventfd is only available on Linux.
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+#endif
 
 template <typename T>
 class ConcurrentQueue
 {
 public:
+	// Capacity of a queue that never runs out of room.
+	enum : size_t { Unbounded = static_cast<size_t>(-1) };
+
 	ConcurrentQueue();
+
+	// Hold at most 'capacity' elements. Pushes wait, or fail, while the queue is full, so producers that outrun
+	// their consumers are slowed down instead of growing the queue. Throws std::invalid_argument if zero.
+	explicit ConcurrentQueue(size_t capacity);
+
 	~ConcurrentQueue();
 
 	ConcurrentQueue(const ConcurrentQueue<T>& other) = delete;
@@ -15,27 +49,250 @@ public:
 	ConcurrentQueue(ConcurrentQueue<T>&& other) = delete;
 	ConcurrentQueue<T>& operator=(ConcurrentQueue<T>&& other) = delete;
 
+	// Result of a pop that waits with a deadline.
+	enum class PopStatus { Success, Timeout, Closed };
+
+	// Wait for room if the queue is bounded and full.
+	// Throws std::logic_error if the queue has been closed, including while waiting.
 	void Push(const T& value);
+	void Push(T&& value);
+
+	// Construct an element at the back of the queue from 'args', waiting for room like Push.
+	// Throws std::logic_error if the queue has been closed.
+	template<typename... TArgs>
+	void Emplace(TArgs&&... args);
+
+	// Push every element of [first, last) with a single acquisition of the tail lock, waiting until there is room
+	// for all of them. Throws std::logic_error if the queue has been closed, and std::length_error if there are more
+	// elements than the capacity.
+	template<typename TIterator>
+	void PushBulk(TIterator first, TIterator last);
+
+	// Return false without waiting if the queue is full.
+	// Throws std::logic_error if the queue has been closed.
+	bool TryPush(const T& value);
+	bool TryPush(T&& value);
+
+	// Same as Push, for symmetry with WaitAndPop.
+	void WaitAndPush(const T& value);
+	void WaitAndPush(T&& value);
+
+	// Wait for room until 'timeout' elapses. Return false if the queue was still full.
+	// Throws std::logic_error if the queue has been closed.
+	template<typename TRep, typename TPeriod>
+	bool WaitAndPushFor(const T& value, const std::chrono::duration<TRep, TPeriod>& timeout);
+	template<typename TRep, typename TPeriod>
+	bool WaitAndPushFor(T&& value, const std::chrono::duration<TRep, TPeriod>& timeout);
 
 	std::shared_ptr<T> TryPop();
 	bool TryPop(T& result);
 
+	// Move the front of the queue out, or return an empty optional if the queue is empty.
+	std::optional<T> TryPopValue();
+
+	// Move up to 'maxCount' elements into 'output' with a single acquisition of the head lock.
+	// Return the number of elements popped.
+	template<typename TOutputIterator>
+	size_t PopBulk(TOutputIterator output, size_t maxCount);
+
+	// Like PopBulk, but keep collecting elements until 'maxCount' have been popped, 'linger' elapses,
+	// or the queue is closed and drained.
+	template<typename TOutputIterator, typename TRep, typename TPeriod>
+	size_t PopBulkFor(TOutputIterator output, size_t maxCount, const std::chrono::duration<TRep, TPeriod>& linger);
+
+	// Return nullptr or false once the queue has been closed and drained.
 	std::shared_ptr<T> WaitAndPop();
 	bool WaitAndPop(T& result);
+	std::optional<T> WaitAndPopValue();
+
+	// Wait for an element until 'timeout' elapses or 'deadline' passes.
+	template<typename TRep, typename TPeriod>
+	PopStatus WaitAndPopFor(T& result, const std::chrono::duration<TRep, TPeriod>& timeout);
+	template<typename TClock, typename TDuration>
+	PopStatus WaitAndPopUntil(T& result, const std::chrono::time_point<TClock, TDuration>& deadline);
 
+#if CONCURRENT_QUEUE_COROUTINES
+	// Awaitable returned by PopAsync.
+	template<typename TExecutor>
+	class PopAwaiter;
+
+	// Resumes a coroutine on the thread that hands it an element.
+	struct InlineExecutor
+	{
+		void operator()(std::coroutine_handle<> handle) const { handle.resume(); }
+	};
+
+	// 'co_await PopAsync()' suspends the calling coroutine until an element is available and evaluates to the element,
+	// or to an empty optional once the queue has been closed and drained. A suspended coroutine does not hold a
+	// thread, the push that hands it an element resumes it on the pushing thread. Close resumes every suspended
+	// coroutine, the queue must not be destroyed while coroutines are suspended on it.
+	PopAwaiter<InlineExecutor> PopAsync();
+
+	// Like PopAsync, but the coroutine is handed to 'executor', called as executor(handle), instead of being
+	// resumed on the pushing thread.
+	template<typename TExecutor>
+	PopAwaiter<typename std::decay<TExecutor>::type> PopAsync(TExecutor&& executor);
+#endif
+
+	// Reject further pushes and wake every waiting consumer and producer. Elements already in the queue can still
+	// be popped, waiting pops report the queue as closed once it has been drained.
+	void Close();
+	bool IsClosed() const;
+
+	// Lock free. Exact when no other thread is pushing or popping.
+	size_t SizeApprox() const;
 	bool Empty() const;
 
+	// Maximum number of elements, Unbounded if there is no limit.
+	size_t Capacity() const;
+
+#if defined(__linux__)
+	// Create an eventfd that becomes readable when an element is pushed, so that an epoll or poll loop can wait for
+	// the queue along with its sockets. Only the first push after the last ResetReadiness writes to the eventfd,
+	// later pushes are coalesced. Return the descriptor, which is owned and closed by the queue.
+	// Must be called before the queue is shared between threads. Throws std::system_error if it cannot be created.
+	int EnableReadinessHandle();
+
+	// Make the descriptor unreadable until the next push. A reactor calls this when the descriptor is readable and
+	// then pops until the queue is empty, so that elements pushed during the reset are either popped or signalled.
+	void ResetReadiness();
+#endif
+
 private:
-	// The ConcurrentQueue is implemented using a unidirectional list of nodes.
+	// The ConcurrentQueue is implemented using a unidirectional list of nodes. Every node but the tail holds an
+	// element constructed in place, the tail is a dummy node that receives the next element pushed.
 	struct Node
 	{
-		Node() : data(nullptr), next(nullptr) {}
-		Node(const T& value) : data(std::make_shared<T>(value)), next(nullptr) {}
+		Node() : next(nullptr) {}
 
-		std::shared_ptr<T> data;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
 		Node* next;
+
+		T& Data() { return *reinterpret_cast<T*>(&storage); }
+	};
+
+	// Destroys the element of a node that holds one along with the node.
+	struct PoppedNodeDeleter
+	{
+		void operator()(Node* node) const
+		{
+			node->Data().~T();
+			delete node;
+		}
+	};
+
+	typedef std::unique_ptr<Node, PoppedNodeDeleter> PoppedNodePtr;
+
+#if CONCURRENT_QUEUE_COROUTINES
+	// A coroutine suspended in PopAsync. Linked into the list of suspended coroutines until a push or Close
+	// detaches it, which happens under the head lock like every other pop.
+	struct AsyncWaiter
+	{
+		AsyncWaiter() : resume(nullptr), next(nullptr) {}
+
+		std::coroutine_handle<> handle;
+
+		// Hands the coroutine to its executor.
+		void (*resume)(AsyncWaiter& waiter);
+
+		// The popped element, nullptr if the queue was closed and drained.
+		PoppedNodePtr node;
+
+		AsyncWaiter* next;
+	};
+
+public:
+	template<typename TExecutor>
+	class PopAwaiter : private AsyncWaiter
+	{
+	public:
+		PopAwaiter(ConcurrentQueue<T>& queue, TExecutor executor);
+
+		bool await_ready();
+		bool await_suspend(std::coroutine_handle<> handle);
+		std::optional<T> await_resume();
+
+	private:
+		static void Resume(AsyncWaiter& waiter);
+
+		ConcurrentQueue<T>& m_queue;
+		TExecutor m_executor;
 	};
 
+private:
+#endif
+
+	// Number of attempts a waiting pop makes before it parks on the condition variable.
+	enum : size_t { SpinCount = 64 };
+
+	// Allocate a node holding an element constructed from 'args'.
+	template<typename... TArgs>
+	static Node* NewNode(TArgs&&... args);
+
+	// Construct an element at the back of the queue from 'args'. A full queue fails right away if 'wait' is false,
+	// otherwise it is waited on until 'deadline' passes, or forever if 'deadline' is nullptr.
+	// Return false if the queue was still full.
+	template<typename TClock, typename TDuration, typename... TArgs>
+	bool EmplaceBack(bool wait, const std::chrono::time_point<TClock, TDuration>* deadline, TArgs&&... args);
+
+	// Whether 'count' more elements fit. The tail lock must be held.
+	bool HasRoom(size_t count) const;
+
+	// Park on the not full condition variable until 'count' more elements fit, the queue is closed, or 'deadline'
+	// passes, if not nullptr. Return true if there is room. The tail lock must be held.
+	// Throws std::logic_error if the queue has been closed.
+	template<typename TClock, typename TDuration>
+	bool WaitForRoom(std::unique_lock<std::mutex>& tailLock, size_t count, const std::chrono::time_point<TClock, TDuration>* deadline);
+
+	// Wake sleeping producers after 'count' elements were popped.
+	void NotifyProducers(size_t count);
+
+	// Unlink the front node, or return nullptr if the queue is empty.
+	PoppedNodePtr TryPopNode();
+
+	// Unlink the front node, parking until there is one. Return nullptr once the queue is closed and drained.
+	PoppedNodePtr WaitAndPopNode();
+
+#if CONCURRENT_QUEUE_COROUTINES
+	// Register 'waiter' to be handed the next element. Return false without registering if an element was popped
+	// into 'waiter' right away or the queue has been closed and drained.
+	bool SuspendAsyncWaiter(AsyncWaiter& waiter);
+
+	// Pop the available elements into suspended coroutines in the order they were suspended, or hand them the close
+	// once the queue is closed and drained. Return the detached coroutines. The head lock must be held.
+	AsyncWaiter* DetachAsyncWaiters();
+
+	static void ResumeAsyncWaiters(AsyncWaiter* waiters);
+#endif
+
+	// Wake sleeping consumers, and raise the readiness handle, after 'count' elements were pushed.
+	void NotifyWaiters(size_t count);
+
+	// Unlink the front node. The head lock must be held and the queue must not be empty.
+	Node* PopFront();
+
+	// Unlink up to 'maxCount' nodes from the front of the queue into a null terminated chain. The head lock must be held.
+	Node* DetachFront(size_t maxCount, size_t& count);
+
+	// Move the element of every node in 'chain' into 'output' and delete the nodes.
+	template<typename TOutputIterator>
+	static void DeliverChain(Node* chain, TOutputIterator& output);
+
+	// Delete every node in 'chain' along with its element.
+	static void DeleteChain(Node* chain);
+
+	// Condition variable predicate, records in 'notEmpty' whether the queue has an element. The head lock must be held.
+	bool NotEmptyOrClosed(bool& notEmpty) const;
+
+	// Number of elements in the queue as seen by a consumer. The head lock must be held.
+	size_t AvailableToPop() const;
+
+	// Park on the condition variable until the queue is not empty, it is closed, or 'deadline' passes.
+	// Return true if the queue is not empty. The head lock must be held.
+	bool WaitUntilNotEmpty(std::unique_lock<std::mutex>& headLock);
+	template<typename TClock, typename TDuration>
+	bool WaitUntilNotEmpty(std::unique_lock<std::mutex>& headLock, const std::chrono::time_point<TClock, TDuration>& deadline);
+
 private:
 	Node* m_head;
 	Node* m_tail;
@@ -44,152 +301,950 @@ private:
 	mutable std::mutex m_tailMutex;
 
 	std::condition_variable m_notEmptyCondition;
+
+	// Number of consumers parked, or about to park, on the condition variable.
+	// A push only pays for a wake up when this is not zero.
+	std::atomic<size_t> m_sleepingWaiters;
+
+	// Number of elements ever pushed, only advanced under the tail lock once the elements are fully linked,
+	// and number of elements ever popped, only advanced under the head lock. Consumers compare the two instead
+	// of m_head and m_tail, so they never need the tail lock.
+	std::atomic<size_t> m_pushCount;
+	std::atomic<size_t> m_popCount;
+
+	// Only set while holding the head lock, so a consumer cannot miss it between its check and its wait.
+	std::atomic<bool> m_closed;
+
+	const size_t m_capacity;
+
+	// Producers parked on a full queue, with the tail lock in place of the head lock.
+	// A pop only pays for a wake up when m_sleepingProducers is not zero. Bulk pushes need more room than a single
+	// element, so while one of them is parked every pop wakes all producers instead of one that may not fit.
+	// The number of parked bulk pushes is only accessed under the tail lock.
+	std::condition_variable m_notFullCondition;
+	std::atomic<size_t> m_sleepingProducers;
+	size_t m_sleepingBulkProducers;
+
+#if CONCURRENT_QUEUE_COROUTINES
+	// Coroutines suspended in PopAsync in the order they were suspended, only accessed under the head lock.
+	// They count as sleeping waiters, so a push always looks for them.
+	AsyncWaiter* m_firstAsyncWaiter = nullptr;
+	AsyncWaiter* m_lastAsyncWaiter = nullptr;
+#endif
+
+#if defined(__linux__)
+	// The eventfd, or -1 if readiness notification is not enabled, and whether it has been written to since the
+	// last reset. The flag is sequentially consistent like the push count, so either a push sees a reset or the
+	// pops following the reset see that push's element.
+	int m_readinessHandle = -1;
+	std::atomic<bool> m_readinessRaised = { false };
+#endif
 };
 
 template<typename T>
-inline ConcurrentQueue<T>::ConcurrentQueue() : m_head(new Node()), m_tail(m_head)
+inline ConcurrentQueue<T>::ConcurrentQueue() : ConcurrentQueue(Unbounded)
 {
 }
 
+template<typename T>
+inline ConcurrentQueue<T>::ConcurrentQueue(size_t capacity) : m_head(nullptr), m_tail(nullptr), m_sleepingWaiters(0), m_pushCount(0), m_popCount(0), m_closed(false),
+	m_capacity(capacity), m_sleepingProducers(0), m_sleepingBulkProducers(0)
+{
+	if (capacity == 0)
+	{
+		throw std::invalid_argument("ConcurrentQueue capacity must not be zero.");
+	}
+
+	m_head = m_tail = new Node();
+}
+
 template<typename T>
 inline ConcurrentQueue<T>::~ConcurrentQueue()
 {
-	while (m_head != nullptr)
+	// Every node but the dummy tail holds an element.
+	while (m_head != m_tail)
 	{
-		Node* currentNode = m_head;
+		PoppedNodePtr currentNode(m_head);
 		m_head = m_head->next;
-		delete currentNode;
 	}
+	delete m_tail;
+
+#if defined(__linux__)
+	if (m_readinessHandle != -1)
+	{
+		::close(m_readinessHandle);
+	}
+#endif
 }
 
 template<typename T>
 inline void ConcurrentQueue<T>::Push(const T& value)
 {
-	std::lock_guard<std::mutex> lock(m_tailMutex);
+	Emplace(value);
+}
 
-	// Append the new node to the end of the queue.
-	m_tail->next = new Node(value);
+template<typename T>
+inline void ConcurrentQueue<T>::Push(T&& value)
+{
+	Emplace(std::move(value));
+}
 
-	// Swap data values with the dummy node moving the dummy node to the end of the queue.
-	std::swap(m_tail->data, m_tail->next->data);
+template<typename T>
+template<typename... TArgs>
+inline void ConcurrentQueue<T>::Emplace(TArgs&&... args)
+{
+	EmplaceBack<std::chrono::steady_clock, std::chrono::steady_clock::duration>(true, nullptr, std::forward<TArgs>(args)...);
+}
 
-	// Update tail to point to the new dummy node.
-	m_tail = m_tail->next;
+template<typename T>
+inline bool ConcurrentQueue<T>::TryPush(const T& value)
+{
+	return EmplaceBack<std::chrono::steady_clock, std::chrono::steady_clock::duration>(false, nullptr, value);
+}
 
-	m_notEmptyCondition.notify_all();
+template<typename T>
+inline bool ConcurrentQueue<T>::TryPush(T&& value)
+{
+	return EmplaceBack<std::chrono::steady_clock, std::chrono::steady_clock::duration>(false, nullptr, std::move(value));
 }
 
 template<typename T>
-inline std::shared_ptr<T> ConcurrentQueue<T>::TryPop()
+inline void ConcurrentQueue<T>::WaitAndPush(const T& value)
 {
-	std::unique_lock<std::mutex> tailLock(m_tailMutex);
-	std::unique_lock<std::mutex> headLock(m_headMutex);
+	Emplace(value);
+}
+
+template<typename T>
+inline void ConcurrentQueue<T>::WaitAndPush(T&& value)
+{
+	Emplace(std::move(value));
+}
+
+template<typename T>
+template<typename TRep, typename TPeriod>
+inline bool ConcurrentQueue<T>::WaitAndPushFor(const T& value, const std::chrono::duration<TRep, TPeriod>& timeout)
+{
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+	return EmplaceBack(true, &deadline, value);
+}
+
+template<typename T>
+template<typename TRep, typename TPeriod>
+inline bool ConcurrentQueue<T>::WaitAndPushFor(T&& value, const std::chrono::duration<TRep, TPeriod>& timeout)
+{
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+	return EmplaceBack(true, &deadline, std::move(value));
+}
+
+template<typename T>
+template<typename TClock, typename TDuration, typename... TArgs>
+inline bool ConcurrentQueue<T>::EmplaceBack(bool wait, const std::chrono::time_point<TClock, TDuration>* deadline, TArgs&&... args)
+{
+	// The next dummy node is allocated outside of the lock.
+	std::unique_ptr<Node> newDummyNode(new Node());
+
+	{
+		std::unique_lock<std::mutex> lock(m_tailMutex);
 
-	// If only the dummy node is present than the queue is empty.
-	if (m_head == m_tail)
+		if (m_closed.load())
+		{
+			throw std::logic_error("Push on a closed ConcurrentQueue.");
+		}
+
+		if (!HasRoom(1) && (!wait || !WaitForRoom(lock, 1, deadline)))
+		{
+			return false;
+		}
+
+		// Construct the element in the current dummy node, nothing has changed if this throws.
+		new (&m_tail->storage) T(std::forward<TArgs>(args)...);
+
+		// Append the new dummy node to the end of the queue and update tail to point to it.
+		m_tail->next = newDummyNode.release();
+		m_tail = m_tail->next;
+
+		// Publish the element to consumers.
+		++m_pushCount;
+	}
+
+	NotifyWaiters(1);
+	return true;
+}
+
+template<typename T>
+template<typename TIterator>
+inline void ConcurrentQueue<T>::PushBulk(TIterator first, TIterator last)
+{
+	if (first == last)
+	{
+		return;
+	}
+
+	// The current dummy node receives the first element, the rest of the chain is built outside of the lock
+	// and is followed by the new dummy node. Only the first element is moved once more under the lock.
+	T firstValue(*first);
+	std::unique_ptr<Node> newDummyNode(new Node());
+	Node* chainFirst = nullptr;
+	Node* chainLast = nullptr;
+	size_t count = 1;
+
+	try
+	{
+		Node** link = &chainFirst;
+		for (++first; first != last; ++first, ++count)
+		{
+			chainLast = *link = NewNode(*first);
+			link = &chainLast->next;
+		}
+	}
+	catch (...)
+	{
+		DeleteChain(chainFirst);
+		throw;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_tailMutex);
+
+		try
+		{
+			if (m_closed.load())
+			{
+				throw std::logic_error("Push on a closed ConcurrentQueue.");
+			}
+
+			if (count > m_capacity)
+			{
+				throw std::length_error("PushBulk of more elements than the ConcurrentQueue capacity.");
+			}
+
+			if (!HasRoom(count))
+			{
+				WaitForRoom<std::chrono::steady_clock, std::chrono::steady_clock::duration>(lock, count, nullptr);
+			}
+
+			new (&m_tail->storage) T(std::move(firstValue));
+		}
+		catch (...)
+		{
+			DeleteChain(chainFirst);
+			throw;
+		}
+
+		Node* newTail = newDummyNode.release();
+		if (chainFirst != nullptr)
+		{
+			m_tail->next = chainFirst;
+			chainLast->next = newTail;
+		}
+		else
+		{
+			m_tail->next = newTail;
+		}
+		m_tail = newTail;
+
+		m_pushCount += count;
+	}
+
+	NotifyWaiters(count);
+}
+
+template<typename T>
+inline std::shared_ptr<T> ConcurrentQueue<T>::TryPop()
+{
+	PoppedNodePtr dequedNodePtr = TryPopNode();
+	if (!dequedNodePtr)
 	{
 		return std::shared_ptr<T>();
 	}
 
-	// Tail is not examined beyond this point.
-	tailLock.unlock();
+	return std::make_shared<T>(std::move(dequedNodePtr->Data()));
+}
 
-	std::unique_ptr<Node> dequedNodePtr(m_head);
-	m_head = m_head->next;
+template<typename T>
+inline bool ConcurrentQueue<T>::TryPop(T& result)
+{
+	PoppedNodePtr dequedNodePtr = TryPopNode();
+	if (!dequedNodePtr)
+	{
+		return false;
+	}
+
+	result = std::move(dequedNodePtr->Data());
+	return true;
+}
+
+template<typename T>
+inline std::optional<T> ConcurrentQueue<T>::TryPopValue()
+{
+	PoppedNodePtr dequedNodePtr = TryPopNode();
+	if (!dequedNodePtr)
+	{
+		return std::nullopt;
+	}
+
+	return std::optional<T>(std::move(dequedNodePtr->Data()));
+}
+
+template<typename T>
+template<typename TOutputIterator>
+inline size_t ConcurrentQueue<T>::PopBulk(TOutputIterator output, size_t maxCount)
+{
+	std::unique_lock<std::mutex> headLock(m_headMutex);
+
+	size_t count;
+	Node* chain = DetachFront(maxCount, count);
 
-	// Head pointer not examined beyond this point.
 	headLock.unlock();
 
-	// --- From this point on multiple threads can delete their old nodes and return their data safely. ---
+	// --- Multiple threads can safely copy out and delete their detached nodes beyond this point. ---
 
-	std::shared_ptr<T> dataPtr = dequedNodePtr->data;
-	return dataPtr;
+	DeliverChain(chain, output);
+	return count;
 }
 
 template<typename T>
-inline bool ConcurrentQueue<T>::TryPop(T& result)
+template<typename TOutputIterator, typename TRep, typename TPeriod>
+inline size_t ConcurrentQueue<T>::PopBulkFor(TOutputIterator output, size_t maxCount, const std::chrono::duration<TRep, TPeriod>& linger)
 {
-	std::unique_lock<std::mutex> tailLock(m_tailMutex);
+	auto deadline = std::chrono::steady_clock::now() + linger;
+	size_t popped = 0;
+
 	std::unique_lock<std::mutex> headLock(m_headMutex);
+	while (true)
+	{
+		size_t count;
+		Node* chain = DetachFront(maxCount - popped, count);
+		popped += count;
+
+		headLock.unlock();
+		DeliverChain(chain, output);
+
+		if (popped == maxCount)
+		{
+			return popped;
+		}
+
+		// Whatever arrives while parked is collected in one go on the next iteration.
+		headLock.lock();
+		if (!WaitUntilNotEmpty(headLock, deadline))
+		{
+			return popped;
+		}
+	}
+}
 
-	// If head and tail both point to the empty node the deque was unsuccessful.
-	if (m_head == m_tail)
+template<typename T>
+inline std::shared_ptr<T> ConcurrentQueue<T>::WaitAndPop()
+{
+	PoppedNodePtr dequedNodePtr = WaitAndPopNode();
+	if (!dequedNodePtr)
+	{
+		return std::shared_ptr<T>();
+	}
+
+	return std::make_shared<T>(std::move(dequedNodePtr->Data()));
+}
+
+template<typename T>
+inline bool ConcurrentQueue<T>::WaitAndPop(T& result)
+{
+	PoppedNodePtr dequedNodePtr = WaitAndPopNode();
+	if (!dequedNodePtr)
 	{
 		return false;
 	}
 
-	// The tail pointer is not examine beyond this point.
-	tailLock.unlock();
+	result = std::move(dequedNodePtr->Data());
+	return true;
+}
+
+template<typename T>
+inline std::optional<T> ConcurrentQueue<T>::WaitAndPopValue()
+{
+	PoppedNodePtr dequedNodePtr = WaitAndPopNode();
+	if (!dequedNodePtr)
+	{
+		return std::nullopt;
+	}
 
-	std::unique_ptr<Node> dequedNodePtr(m_head);
-	m_head = m_head->next;
+	return std::optional<T>(std::move(dequedNodePtr->Data()));
+}
+
+template<typename T>
+template<typename TRep, typename TPeriod>
+inline typename ConcurrentQueue<T>::PopStatus ConcurrentQueue<T>::WaitAndPopFor(T& result, const std::chrono::duration<TRep, TPeriod>& timeout)
+{
+	return WaitAndPopUntil(result, std::chrono::steady_clock::now() + timeout);
+}
+
+template<typename T>
+template<typename TClock, typename TDuration>
+inline typename ConcurrentQueue<T>::PopStatus ConcurrentQueue<T>::WaitAndPopUntil(T& result, const std::chrono::time_point<TClock, TDuration>& deadline)
+{
+	for (size_t i = 0; i < SpinCount; ++i)
+	{
+		if (TryPop(result))
+		{
+			return PopStatus::Success;
+		}
+	}
+
+	std::unique_lock<std::mutex> headLock(m_headMutex);
+	if (!WaitUntilNotEmpty(headLock, deadline))
+	{
+		return m_closed.load() ? PopStatus::Closed : PopStatus::Timeout;
+	}
+
+	PoppedNodePtr dequedNodePtr(PopFront());
 
-	// New head node not examined beyond this point.
 	headLock.unlock();
 
-	// --- Multiple threads can safely delete the dequed node and copy its data beyond this point. ---
+	// --- No further modifications to the head pointer past this point. ---
 
-	result = *(dequedNodePtr->data.get());
-	return true;
+	result = std::move(dequedNodePtr->Data());
+	return PopStatus::Success;
 }
 
+#if CONCURRENT_QUEUE_COROUTINES
 template<typename T>
-inline std::shared_ptr<T> ConcurrentQueue<T>::WaitAndPop()
+inline typename ConcurrentQueue<T>::template PopAwaiter<typename ConcurrentQueue<T>::InlineExecutor> ConcurrentQueue<T>::PopAsync()
 {
-	std::unique_lock<std::mutex> headLock(m_headMutex);
+	return PopAwaiter<InlineExecutor>(*this, InlineExecutor());
+}
+
+template<typename T>
+template<typename TExecutor>
+inline typename ConcurrentQueue<T>::template PopAwaiter<typename std::decay<TExecutor>::type> ConcurrentQueue<T>::PopAsync(TExecutor&& executor)
+{
+	return PopAwaiter<typename std::decay<TExecutor>::type>(*this, std::forward<TExecutor>(executor));
+}
 
-	auto notEmptyPredicate = [&]() -> bool
+template<typename T>
+template<typename TExecutor>
+inline ConcurrentQueue<T>::PopAwaiter<TExecutor>::PopAwaiter(ConcurrentQueue<T>& queue, TExecutor executor) : m_queue(queue), m_executor(std::move(executor))
+{
+	this->resume = &PopAwaiter<TExecutor>::Resume;
+}
+
+template<typename T>
+template<typename TExecutor>
+inline bool ConcurrentQueue<T>::PopAwaiter<TExecutor>::await_ready()
+{
+	// Only suspend if there is no element to take.
+	this->node = m_queue.TryPopNode();
+	return this->node != nullptr;
+}
+
+template<typename T>
+template<typename TExecutor>
+inline bool ConcurrentQueue<T>::PopAwaiter<TExecutor>::await_suspend(std::coroutine_handle<> handle)
+{
+	this->handle = handle;
+	return m_queue.SuspendAsyncWaiter(*this);
+}
+
+template<typename T>
+template<typename TExecutor>
+inline std::optional<T> ConcurrentQueue<T>::PopAwaiter<TExecutor>::await_resume()
+{
+	if (!this->node)
 	{
+		return std::nullopt;
+	}
+
+	return std::optional<T>(std::move(this->node->Data()));
+}
+
+template<typename T>
+template<typename TExecutor>
+inline void ConcurrentQueue<T>::PopAwaiter<TExecutor>::Resume(AsyncWaiter& waiter)
+{
+	PopAwaiter<TExecutor>& awaiter = static_cast<PopAwaiter<TExecutor>&>(waiter);
+	awaiter.m_executor(awaiter.handle);
+}
+#endif
+
+template<typename T>
+inline void ConcurrentQueue<T>::Close()
+{
+#if CONCURRENT_QUEUE_COROUTINES
+	AsyncWaiter* closedWaiters;
+#endif
+
+	// Holding both locks means a push that got past its check of the close has linked its element before any
+	// consumer can see the close, and that consumers and producers about to park are parked before they are notified.
+	{
+		std::lock_guard<std::mutex> headLock(m_headMutex);
 		std::lock_guard<std::mutex> tailLock(m_tailMutex);
-		return m_head != m_tail;
+		m_closed.store(true);
+
+#if CONCURRENT_QUEUE_COROUTINES
+		closedWaiters = DetachAsyncWaiters();
+#endif
+	}
+
+	// Every waiter has to observe the close, not just one.
+	m_notEmptyCondition.notify_all();
+	m_notFullCondition.notify_all();
+
+#if CONCURRENT_QUEUE_COROUTINES
+	ResumeAsyncWaiters(closedWaiters);
+#endif
+}
+
+template<typename T>
+inline bool ConcurrentQueue<T>::IsClosed() const
+{
+	return m_closed.load();
+}
+
+template<typename T>
+inline size_t ConcurrentQueue<T>::SizeApprox() const
+{
+	// Loading the pop count first means the push count read after it can only be larger, so the size never underflows.
+	size_t popCount = m_popCount.load();
+	return m_pushCount.load() - popCount;
+}
+
+template<typename T>
+inline bool ConcurrentQueue<T>::Empty() const
+{
+	return SizeApprox() == 0;
+}
+
+template<typename T>
+inline size_t ConcurrentQueue<T>::Capacity() const
+{
+	return m_capacity;
+}
+
+template<typename T>
+template<typename... TArgs>
+inline typename ConcurrentQueue<T>::Node* ConcurrentQueue<T>::NewNode(TArgs&&... args)
+{
+	std::unique_ptr<Node> newNode(new Node());
+	new (&newNode->storage) T(std::forward<TArgs>(args)...);
+	return newNode.release();
+}
+
+template<typename T>
+inline bool ConcurrentQueue<T>::HasRoom(size_t count) const
+{
+	// The push count is exact under the tail lock and the pop count only grows, so the size is never underestimated.
+	return m_capacity == Unbounded || m_pushCount.load(std::memory_order_relaxed) - m_popCount.load() + count <= m_capacity;
+}
+
+template<typename T>
+template<typename TClock, typename TDuration>
+inline bool ConcurrentQueue<T>::WaitForRoom(std::unique_lock<std::mutex>& tailLock, size_t count, const std::chrono::time_point<TClock, TDuration>* deadline)
+{
+	bool hasRoom = false;
+	auto hasRoomOrClosed = [&]() -> bool
+	{
+		hasRoom = HasRoom(count);
+		return hasRoom || m_closed.load();
 	};
 
-	// --- The tail lock is not needed beyond the above predicate. ---
+	// Register before the predicate is first checked. Both the registration and the pop count are sequentially
+	// consistent, so either the check sees a concurrent pop or that pop sees the registration.
+	++m_sleepingProducers;
+	if (count > 1)
+	{
+		++m_sleepingBulkProducers;
+	}
 
-	m_notEmptyCondition.wait(headLock, notEmptyPredicate);
+	if (deadline == nullptr)
+	{
+		m_notFullCondition.wait(tailLock, hasRoomOrClosed);
+	}
+	else
+	{
+		m_notFullCondition.wait_until(tailLock, *deadline, hasRoomOrClosed);
+	}
 
-	std::unique_ptr<Node> dequedNodePtr(m_head);
-	std::shared_ptr<T> dataPtr = dequedNodePtr->data;
-	m_head = m_head->next;
+	if (count > 1)
+	{
+		--m_sleepingBulkProducers;
+	}
+	--m_sleepingProducers;
 
-	// --- The head lock is not required beyond this point. ---
-	headLock.unlock();
+	// Room freed up at the same time as the close does not matter, no more elements are accepted.
+	if (m_closed.load())
+	{
+		throw std::logic_error("Push on a closed ConcurrentQueue.");
+	}
 
-	// Multiple threads are now able to return their data and delete their front node.
-	return dataPtr;
+	return hasRoom;
 }
 
 template<typename T>
-inline bool ConcurrentQueue<T>::WaitAndPop(T& result)
+inline void ConcurrentQueue<T>::NotifyProducers(size_t count)
 {
-	std::unique_lock<std::mutex> headLock(m_headMutex);
+	size_t sleepingProducers = m_sleepingProducers.load();
+	if (sleepingProducers == 0)
+	{
+		return;
+	}
 
-	auto notEmptyPredicate = [&]() -> bool
+	// A producer that registered as sleeping holds the tail lock until it is parked, see NotifyWaiters.
+	// Consumers may take the tail lock while holding the head lock, never the other way around.
+	bool notifyAll;
 	{
 		std::lock_guard<std::mutex> tailLock(m_tailMutex);
-		return m_head != m_tail;
-	};
+		notifyAll = count >= sleepingProducers || m_sleepingBulkProducers != 0;
+	}
 
-	// --- tail is not accessed outside of the predicate. ---
+	if (notifyAll)
+	{
+		m_notFullCondition.notify_all();
+	}
+	else
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_notFullCondition.notify_one();
+		}
+	}
+}
 
-	m_notEmptyCondition.wait(headLock, notEmptyPredicate);
+template<typename T>
+inline typename ConcurrentQueue<T>::PoppedNodePtr ConcurrentQueue<T>::TryPopNode()
+{
+	// Fail fast without touching either lock, so idle polling does not slow down anyone else.
+	if (Empty())
+	{
+		return PoppedNodePtr();
+	}
 
-	std::unique_ptr<Node> dequedNodePtr(m_head);
-	m_head = m_head->next;
+	std::unique_lock<std::mutex> headLock(m_headMutex);
 
+	// Another consumer may have taken the last element in the meantime.
+	if (AvailableToPop() == 0)
+	{
+		return PoppedNodePtr();
+	}
+
+	PoppedNodePtr dequedNodePtr(PopFront());
+
+	// Head pointer not examined beyond this point.
 	headLock.unlock();
 
-	// --- No further modifications to the head pointer past this point. ---
+	// --- From this point on multiple threads can move out their elements and delete their old nodes safely. ---
 
-	// Multiple threads are safe to copy the data and delete the dequed node.
-	result = *(dequedNodePtr->data);
-	return true;
+	return dequedNodePtr;
 }
 
 template<typename T>
-inline bool ConcurrentQueue<T>::Empty() const
+inline typename ConcurrentQueue<T>::PoppedNodePtr ConcurrentQueue<T>::WaitAndPopNode()
+{
+	// An element often arrives shortly after the queue runs dry, so try a few times before paying for parking.
+	for (size_t i = 0; i < SpinCount; ++i)
+	{
+		if (PoppedNodePtr dequedNodePtr = TryPopNode())
+		{
+			return dequedNodePtr;
+		}
+	}
+
+	std::unique_lock<std::mutex> headLock(m_headMutex);
+	if (!WaitUntilNotEmpty(headLock))
+	{
+		return PoppedNodePtr();
+	}
+
+	PoppedNodePtr dequedNodePtr(PopFront());
+
+	// --- The head lock is not required beyond this point. ---
+	headLock.unlock();
+
+	// Multiple threads are now able to move out their elements and delete their front node.
+	return dequedNodePtr;
+}
+
+#if defined(__linux__)
+template<typename T>
+inline int ConcurrentQueue<T>::EnableReadinessHandle()
+{
+	if (m_readinessHandle != -1)
+	{
+		return m_readinessHandle;
+	}
+
+	m_readinessHandle = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_readinessHandle == -1)
+	{
+		throw std::system_error(errno, std::system_category(), "eventfd");
+	}
+
+	// Elements pushed before the handle existed are signalled right away.
+	if (!Empty())
+	{
+		uint64_t increment = 1;
+		ssize_t written = ::write(m_readinessHandle, &increment, sizeof(increment));
+		(void)written;
+		m_readinessRaised.store(true);
+	}
+
+	return m_readinessHandle;
+}
+
+template<typename T>
+inline void ConcurrentQueue<T>::ResetReadiness()
+{
+	if (m_readinessHandle == -1)
+	{
+		return;
+	}
+
+	// Drain the eventfd before clearing the flag. The other way around a push could find the flag cleared and write
+	// just before the drain, leaving the flag raised with nothing to read, and no later push would write again.
+	uint64_t count;
+	ssize_t readBytes = ::read(m_readinessHandle, &count, sizeof(count));
+	(void)readBytes;
+	m_readinessRaised.store(false);
+}
+#endif
+
+template<typename T>
+inline void ConcurrentQueue<T>::NotifyWaiters(size_t count)
+{
+	// A consumer that registered as sleeping holds the head lock until it is parked, so taking the head lock
+	// before notifying guarantees that the notification cannot slip in between its check and its wait.
+#if defined(__linux__)
+	// Only the first push since the last reset pays for the system call.
+	if (m_readinessHandle != -1 && !m_readinessRaised.load() && !m_readinessRaised.exchange(true))
+	{
+		uint64_t increment = 1;
+		ssize_t written = ::write(m_readinessHandle, &increment, sizeof(increment));
+		(void)written;
+	}
+#endif
+
+	size_t sleepingWaiters = m_sleepingWaiters.load();
+	if (sleepingWaiters == 0)
+	{
+		return;
+	}
+
+#if CONCURRENT_QUEUE_COROUTINES
+	// Suspended coroutines take their elements right away, parked consumers that wake up find whatever is left.
+	AsyncWaiter* resumableWaiters;
+	{
+		std::lock_guard<std::mutex> headLock(m_headMutex);
+		resumableWaiters = DetachAsyncWaiters();
+	}
+#else
+	{
+		std::lock_guard<std::mutex> headLock(m_headMutex);
+	}
+#endif
+
+	// Each element needs at most one consumer, so only wake everyone if there is enough for everyone.
+	if (count >= sleepingWaiters)
+	{
+		m_notEmptyCondition.notify_all();
+	}
+	else
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_notEmptyCondition.notify_one();
+		}
+	}
+
+#if CONCURRENT_QUEUE_COROUTINES
+	// Last, since a coroutine resumed on this thread runs until it suspends again.
+	ResumeAsyncWaiters(resumableWaiters);
+#endif
+}
+
+#if CONCURRENT_QUEUE_COROUTINES
+template<typename T>
+inline bool ConcurrentQueue<T>::SuspendAsyncWaiter(AsyncWaiter& waiter)
 {
 	std::lock_guard<std::mutex> headLock(m_headMutex);
-	std::lock_guard<std::mutex> tailLock(m_tailMutex);
-	return m_head == m_tail;
+
+	// Register before checking for an element, for the same reason as a parking consumer, see WaitUntilNotEmpty.
+	++m_sleepingWaiters;
+	if (AvailableToPop() == 0 && !m_closed.load())
+	{
+		if (m_lastAsyncWaiter == nullptr)
+		{
+			m_firstAsyncWaiter = &waiter;
+		}
+		else
+		{
+			m_lastAsyncWaiter->next = &waiter;
+		}
+		m_lastAsyncWaiter = &waiter;
+
+		// --- The coroutine may be resumed, and the waiter destroyed, as soon as the head lock is released. ---
+		return true;
+	}
+	--m_sleepingWaiters;
+
+	if (AvailableToPop() != 0)
+	{
+		waiter.node.reset(PopFront());
+	}
+	return false;
+}
+
+template<typename T>
+inline typename ConcurrentQueue<T>::AsyncWaiter* ConcurrentQueue<T>::DetachAsyncWaiters()
+{
+	AsyncWaiter* detachedWaiters = m_firstAsyncWaiter;
+	AsyncWaiter* lastDetachedWaiter = nullptr;
+
+	while (m_firstAsyncWaiter != nullptr)
+	{
+		if (AvailableToPop() != 0)
+		{
+			m_firstAsyncWaiter->node.reset(PopFront());
+		}
+		else if (!m_closed.load())
+		{
+			break;
+		}
+
+		lastDetachedWaiter = m_firstAsyncWaiter;
+		m_firstAsyncWaiter = m_firstAsyncWaiter->next;
+		--m_sleepingWaiters;
+	}
+
+	if (lastDetachedWaiter == nullptr)
+	{
+		return nullptr;
+	}
+
+	lastDetachedWaiter->next = nullptr;
+	if (m_firstAsyncWaiter == nullptr)
+	{
+		m_lastAsyncWaiter = nullptr;
+	}
+	return detachedWaiters;
+}
+
+template<typename T>
+inline void ConcurrentQueue<T>::ResumeAsyncWaiters(AsyncWaiter* waiters)
+{
+	while (waiters != nullptr)
+	{
+		// The waiter lives in the coroutine, which may be gone once it has been resumed.
+		AsyncWaiter* waiter = waiters;
+		waiters = waiters->next;
+		waiter->resume(*waiter);
+	}
+}
+#endif
+
+template<typename T>
+inline typename ConcurrentQueue<T>::Node* ConcurrentQueue<T>::PopFront()
+{
+	Node* front = m_head;
+	m_head = m_head->next;
+	++m_popCount;
+
+	NotifyProducers(1);
+	return front;
+}
+
+template<typename T>
+inline typename ConcurrentQueue<T>::Node* ConcurrentQueue<T>::DetachFront(size_t maxCount, size_t& count)
+{
+	count = std::min(maxCount, AvailableToPop());
+	if (count == 0)
+	{
+		return nullptr;
+	}
+
+	// --- Counted nodes are fully linked and no longer touched by pushes. ---
+
+	Node* chain = m_head;
+	Node* last = m_head;
+	for (size_t i = 1; i < count; ++i)
+	{
+		last = last->next;
+	}
+
+	m_head = last->next;
+	m_popCount += count;
+	NotifyProducers(count);
+
+	last->next = nullptr;
+	return chain;
+}
+
+template<typename T>
+template<typename TOutputIterator>
+inline void ConcurrentQueue<T>::DeliverChain(Node* chain, TOutputIterator& output)
+{
+	try
+	{
+		while (chain != nullptr)
+		{
+			PoppedNodePtr deliveredNode(chain);
+			chain = chain->next;
+
+			*output = std::move(deliveredNode->Data());
+			++output;
+		}
+	}
+	catch (...)
+	{
+		DeleteChain(chain);
+		throw;
+	}
+}
+
+template<typename T>
+inline void ConcurrentQueue<T>::DeleteChain(Node* chain)
+{
+	while (chain != nullptr)
+	{
+		PoppedNodePtr currentNode(chain);
+		chain = chain->next;
+	}
+}
+
+template<typename T>
+inline bool ConcurrentQueue<T>::NotEmptyOrClosed(bool& notEmpty) const
+{
+	notEmpty = AvailableToPop() != 0;
+	return notEmpty || m_closed.load();
+}
+
+template<typename T>
+inline size_t ConcurrentQueue<T>::AvailableToPop() const
+{
+	// Elements counted by the push count have been fully linked before the count was advanced.
+	return m_pushCount.load() - m_popCount.load(std::memory_order_relaxed);
+}
+
+template<typename T>
+inline bool ConcurrentQueue<T>::WaitUntilNotEmpty(std::unique_lock<std::mutex>& headLock)
+{
+	bool notEmpty = false;
+
+	// Register before the predicate is first checked. Both the registration and the push count are sequentially
+	// consistent, so either the check sees a concurrent push or that push sees the registration.
+	++m_sleepingWaiters;
+	m_notEmptyCondition.wait(headLock, [&]() -> bool { return NotEmptyOrClosed(notEmpty); });
+	--m_sleepingWaiters;
+
+	return notEmpty;
+}
+
+template<typename T>
+template<typename TClock, typename TDuration>
+inline bool ConcurrentQueue<T>::WaitUntilNotEmpty(std::unique_lock<std::mutex>& headLock, const std::chrono::time_point<TClock, TDuration>& deadline)
+{
+	bool notEmpty = false;
+
+	++m_sleepingWaiters;
+	m_notEmptyCondition.wait_until(headLock, deadline, [&]() -> bool { return NotEmptyOrClosed(notEmpty); });
+	--m_sleepingWaiters;
+
+	return notEmpty;
 }
@@ -0,0 +1,789 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+#include <stdexcept>
+#include <system_error>
+
+#if defined(_WIN32)
+// Keep std::min and std::max usable in the headers included after this one.
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+// Unbounded queue that keeps its elements in memory mapped segment files in a directory, so that a burst is
+// absorbed by the disk instead of the heap and the elements survive the process.
+//
+// It works like SegmentedConcurrentQueue. Producers append to the tail segment under the tail lock and create the
+// next segment file once it is full. Consumers read from the head segment under the head lock and delete its file
+// once it has been read to the end. Only the head and tail segments are mapped, so however far the consumers fall
+// behind the queue never maps more than two segments, the segments in between only take up disk space. While the
+// consumers keep up both are the same segment, its pages stay in the page cache and elements pass through memory.
+//
+// Every segment file records how many elements have been written to it and how many have been read from it, each
+// advanced after the element it counts, with a compiler fence in between so that a process killed at any point never
+// leaves a counted slot without its element. A queue opened on a directory that already holds segment files carries on
+// where the previous queue left off, with every element that was pushed and not popped. An exited or crashed
+// process loses nothing, a crashed machine loses the elements pushed since the last Flush. To keep that promise a
+// new segment file and its directory entry are written through to the disk before it is used, and so is a full
+// segment before producers move on from it, so after a crash every segment but the last is complete.
+//
+// At most one queue may be open on a directory at a time, which is enforced by an exclusive lock on a lock file in
+// the directory. Elements are copied byte for byte to the files, so T must be trivially copyable and must not hold
+// pointers.
+template<typename T>
+class DurableConcurrentQueue
+{
+	static_assert(std::is_trivially_copyable<T>::value, "DurableConcurrentQueue elements must be trivially copyable.");
+
+public:
+	// Open the queue stored in 'directory', creating the directory if needed. New segment files hold
+	// 'segmentCapacity' elements, segment files recovered from a previous queue keep the capacity they were created
+	// with. Throws std::system_error if a segment file cannot be created or mapped, and std::runtime_error if a
+	// segment file is damaged or was written with another element type, or if another queue, in this process or
+	// another one, has the directory open.
+	explicit DurableConcurrentQueue(const std::string& directory, size_t segmentCapacity = 65536);
+
+	// Unmaps the segments and releases the directory. The segment files stay behind for the next queue opened on
+	// the directory.
+	~DurableConcurrentQueue() = default;
+
+	DurableConcurrentQueue(const DurableConcurrentQueue<T>& other) = delete;
+	DurableConcurrentQueue<T>& operator=(const DurableConcurrentQueue<T>& other) = delete;
+
+	DurableConcurrentQueue(DurableConcurrentQueue<T>&& other) = delete;
+	DurableConcurrentQueue<T>& operator=(DurableConcurrentQueue<T>&& other) = delete;
+
+	// Throws std::system_error if the full tail segment cannot be written through to the disk or the next segment
+	// file cannot be created.
+	void Push(const T& value);
+
+	bool TryPop(T& result);
+	bool WaitAndPop(T& result);
+
+	// Write the mapped segments and the directory through to the disk, so that the elements pushed and popped so
+	// far also survive a crash of the machine.
+	void Flush();
+
+	// Lock free. Exact when no other thread is pushing or popping.
+	size_t SizeApprox() const;
+	bool Empty() const;
+
+private:
+	enum : size_t { CacheLineSize = 64 };
+
+	// Number of attempts a waiting pop makes before it parks on the condition variable.
+	enum : size_t { SpinCount = 64 };
+
+	// Written last when a segment file is created, so that a file whose creation was cut short is recognised.
+	enum : uint64_t { Magic = 0x45555155444C4244ull };
+
+	// Start of every segment file, followed by the elements.
+	struct SegmentHeader
+	{
+		uint64_t magic;
+		uint64_t index;
+		uint64_t capacity;
+		uint64_t elementSize;
+
+		// Only advanced by producers, under the tail lock, and by consumers, under the head lock. Neither side
+		// reads the other's count, they go by the push and pop counts of the queue.
+		alignas(CacheLineSize) uint64_t written;
+		alignas(CacheLineSize) uint64_t read;
+	};
+
+	static_assert(alignof(T) <= CacheLineSize, "DurableConcurrentQueue elements must not be aligned beyond a cache line.");
+
+	// A segment file mapped into memory.
+	class Segment
+	{
+	public:
+		// Create the file at 'path' for the segment 'index' of 'capacity' elements, and write it and its directory
+		// entry through to the disk.
+		Segment(const std::filesystem::path& path, uint64_t index, uint64_t capacity);
+
+		// Map the existing file at 'path'. Its header is not checked.
+		Segment(const std::filesystem::path& path, size_t fileSize);
+
+		~Segment();
+
+		Segment(const Segment& other) = delete;
+		Segment& operator=(const Segment& other) = delete;
+
+		SegmentHeader& Header() const { return *static_cast<SegmentHeader*>(m_region); }
+		T* Elements() const { return reinterpret_cast<T*>(static_cast<char*>(m_region) + sizeof(SegmentHeader)); }
+		const std::filesystem::path& Path() const { return m_path; }
+
+		void Flush() const;
+
+		// Write the file at 'path' through to the disk. Does nothing if it has been deleted.
+		static void SyncFile(const std::filesystem::path& path);
+
+		// Write the entries of 'directory', the files created and deleted in it, through to the disk.
+		static void SyncDirectory(const std::filesystem::path& directory);
+
+	private:
+		// Map the file, creating it first if 'create' is true.
+		void Map(bool create);
+
+		std::filesystem::path m_path;
+		void* m_region;
+		size_t m_regionSize;
+
+#if defined(_WIN32)
+		HANDLE m_file;
+		HANDLE m_mapping;
+#endif
+	};
+
+	// Exclusive lock on the lock file of a directory, held for as long as the queue is open.
+	class DirectoryLock
+	{
+	public:
+		// Throws std::runtime_error if the lock is held by another queue.
+		explicit DirectoryLock(const std::filesystem::path& directory);
+		~DirectoryLock();
+
+		DirectoryLock(const DirectoryLock& other) = delete;
+		DirectoryLock& operator=(const DirectoryLock& other) = delete;
+
+	private:
+#if defined(_WIN32)
+		HANDLE m_file;
+#else
+		int m_handle;
+#endif
+	};
+
+	std::filesystem::path SegmentPath(uint64_t index) const;
+
+	// Return true and set 'index' if 'fileName' is the name of a segment file.
+	static bool ParseSegmentName(const std::string& fileName, uint64_t& index);
+
+	// Pick up the segment files left by a previous queue, deleting the ones that have been read to the end.
+	void Recover();
+
+	// Copy the front element into 'result'. The head lock must be held and the queue must not be empty.
+	void PopFront(T& result);
+
+	// Number of elements in the queue as seen by a consumer. The head lock must be held.
+	size_t AvailableToPop() const;
+
+	// Replace the head segment, which has been read to the end, with the next one and delete its file.
+	// Return false if producers are still writing to it. The head lock must be held.
+	bool AdvanceHeadSegment();
+
+private:
+	std::filesystem::path m_directory;
+	size_t m_segmentCapacity;
+
+	// Taken before the segment files are touched and released after they are unmapped.
+	std::unique_ptr<DirectoryLock> m_directoryLock;
+
+	// The head and tail segments are the same segment until producers move on to the next one.
+	std::shared_ptr<Segment> m_headSegment;
+	std::shared_ptr<Segment> m_tailSegment;
+
+	mutable std::mutex m_headMutex;
+	mutable std::mutex m_tailMutex;
+
+	std::condition_variable m_notEmptyCondition;
+
+	// Number of consumers parked, or about to park, on the condition variable.
+	std::atomic<size_t> m_sleepingWaiters;
+
+	// Number of elements pushed, including the ones recovered, only advanced under the tail lock once the element
+	// is written, and number of elements popped, only advanced under the head lock.
+	std::atomic<size_t> m_pushCount;
+	std::atomic<size_t> m_popCount;
+};
+
+template<typename T>
+inline DurableConcurrentQueue<T>::DurableConcurrentQueue(const std::string& directory, size_t segmentCapacity) :
+	m_directory(directory), m_segmentCapacity(segmentCapacity), m_sleepingWaiters(0), m_pushCount(0), m_popCount(0)
+{
+	if (segmentCapacity == 0)
+	{
+		throw std::invalid_argument("DurableConcurrentQueue segment capacity must not be zero.");
+	}
+
+	std::filesystem::create_directories(m_directory);
+	m_directoryLock.reset(new DirectoryLock(m_directory));
+	Recover();
+}
+
+template<typename T>
+inline void DurableConcurrentQueue<T>::Push(const T& value)
+{
+	{
+		std::lock_guard<std::mutex> tailLock(m_tailMutex);
+
+		// Create the next segment once the tail segment is full. Consumers only open it once an element in it has
+		// been counted, so creating it before writing the element is safe. The full segment is written through to the
+		// disk first, so that a crash of the machine cannot leave an incomplete segment in front of a later one.
+		if (m_tailSegment->Header().written == m_tailSegment->Header().capacity)
+		{
+			m_tailSegment->Flush();
+			uint64_t nextIndex = m_tailSegment->Header().index + 1;
+			m_tailSegment = std::make_shared<Segment>(SegmentPath(nextIndex), nextIndex, m_segmentCapacity);
+		}
+
+		SegmentHeader& header = m_tailSegment->Header();
+		m_tailSegment->Elements()[header.written] = value;
+
+		// Other processes only read the file after this one has gone, so it is enough to keep the compiler from
+		// counting the element before it is written. Retired stores reach the mapping even if the process is killed.
+		std::atomic_signal_fence(std::memory_order_release);
+		++header.written;
+
+		// Publish the element to consumers.
+		++m_pushCount;
+	}
+
+	// A consumer that registered as sleeping holds the head lock until it is parked, so taking the head lock
+	// before notifying guarantees that the notification cannot slip in between its check and its wait.
+	if (m_sleepingWaiters.load() != 0)
+	{
+		{
+			std::lock_guard<std::mutex> headLock(m_headMutex);
+		}
+		m_notEmptyCondition.notify_one();
+	}
+}
+
+template<typename T>
+inline bool DurableConcurrentQueue<T>::TryPop(T& result)
+{
+	// Fail fast without touching either lock, so idle polling does not slow down anyone else.
+	if (Empty())
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> headLock(m_headMutex);
+
+	// Another consumer may have taken the last element in the meantime.
+	if (AvailableToPop() == 0)
+	{
+		return false;
+	}
+
+	PopFront(result);
+	return true;
+}
+
+template<typename T>
+inline bool DurableConcurrentQueue<T>::WaitAndPop(T& result)
+{
+	// An element often arrives shortly after the queue runs dry, so try a few times before paying for parking.
+	for (size_t i = 0; i < SpinCount; ++i)
+	{
+		if (TryPop(result))
+		{
+			return true;
+		}
+	}
+
+	std::unique_lock<std::mutex> headLock(m_headMutex);
+
+	// Register before the predicate is first checked. Both the registration and the push count are sequentially
+	// consistent, so either the check sees a concurrent push or that push sees the registration.
+	++m_sleepingWaiters;
+	m_notEmptyCondition.wait(headLock, [&]() -> bool { return AvailableToPop() != 0; });
+	--m_sleepingWaiters;
+
+	PopFront(result);
+	return true;
+}
+
+template<typename T>
+inline void DurableConcurrentQueue<T>::Flush()
+{
+	// Flush outside of the locks, holding on to the segments so that they stay mapped.
+	std::shared_ptr<Segment> headSegment;
+	{
+		std::lock_guard<std::mutex> headLock(m_headMutex);
+		headSegment = m_headSegment;
+	}
+	std::shared_ptr<Segment> tailSegment;
+	{
+		std::lock_guard<std::mutex> tailLock(m_tailMutex);
+		tailSegment = m_tailSegment;
+	}
+
+	headSegment->Flush();
+	if (tailSegment != headSegment)
+	{
+		// Segments between the two are no longer mapped, so their files are synchronised instead.
+		for (uint64_t index = headSegment->Header().index + 1; index < tailSegment->Header().index; ++index)
+		{
+			Segment::SyncFile(SegmentPath(index));
+		}
+		tailSegment->Flush();
+	}
+
+	// Segment files deleted since the last Flush.
+	Segment::SyncDirectory(m_directory);
+}
+
+template<typename T>
+inline size_t DurableConcurrentQueue<T>::SizeApprox() const
+{
+	// Loading the pop count first means the push count read after it can only be larger, so the size never underflows.
+	size_t popCount = m_popCount.load();
+	return m_pushCount.load() - popCount;
+}
+
+template<typename T>
+inline bool DurableConcurrentQueue<T>::Empty() const
+{
+	return SizeApprox() == 0;
+}
+
+template<typename T>
+inline std::filesystem::path DurableConcurrentQueue<T>::SegmentPath(uint64_t index) const
+{
+	// Zero padded, so that the names sort in the order of the segments.
+	char fileName[64];
+	std::snprintf(fileName, sizeof(fileName), "segment-%020llu.dat", static_cast<unsigned long long>(index));
+	return m_directory / fileName;
+}
+
+template<typename T>
+inline bool DurableConcurrentQueue<T>::ParseSegmentName(const std::string& fileName, uint64_t& index)
+{
+	const std::string prefix = "segment-";
+	const std::string suffix = ".dat";
+	const size_t numDigits = 20;
+
+	if (fileName.size() != prefix.size() + numDigits + suffix.size() || fileName.compare(0, prefix.size(), prefix) != 0 ||
+		fileName.compare(prefix.size() + numDigits, suffix.size(), suffix) != 0)
+	{
+		return false;
+	}
+
+	index = 0;
+	for (size_t i = prefix.size(); i < prefix.size() + numDigits; ++i)
+	{
+		if (fileName[i] < '0' || fileName[i] > '9')
+		{
+			return false;
+		}
+		index = index * 10 + static_cast<uint64_t>(fileName[i] - '0');
+	}
+
+	return true;
+}
+
+template<typename T>
+inline void DurableConcurrentQueue<T>::Recover()
+{
+	std::vector<uint64_t> indices;
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(m_directory))
+	{
+		uint64_t index;
+		if (entry.is_regular_file() && ParseSegmentName(entry.path().filename().string(), index))
+		{
+			indices.push_back(index);
+		}
+	}
+	std::sort(indices.begin(), indices.end());
+
+	uint64_t nextIndex = indices.empty() ? 0 : indices.front();
+	size_t numElements = 0;
+
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		bool last = i + 1 == indices.size();
+		std::filesystem::path path = SegmentPath(indices[i]);
+		size_t fileSize = static_cast<size_t>(std::filesystem::file_size(path));
+
+		std::shared_ptr<Segment> segment;
+		if (fileSize >= sizeof(SegmentHeader))
+		{
+			segment = std::make_shared<Segment>(path, fileSize);
+		}
+
+		// Only the creation of the last segment can have been cut short, and such a segment never held an element.
+		if (segment == nullptr || segment->Header().magic != Magic)
+		{
+			if (!last)
+			{
+				throw std::runtime_error("DurableConcurrentQueue segment file is damaged.");
+			}
+			segment.reset();
+			std::filesystem::remove(path);
+			break;
+		}
+
+		SegmentHeader& header = segment->Header();
+		if (header.elementSize != sizeof(T))
+		{
+			throw std::runtime_error("DurableConcurrentQueue segment file holds elements of another size.");
+		}
+
+		// Segments are numbered without gaps, and producers only move on from a segment once it is full.
+		if (header.index != indices[i] || header.index != nextIndex || fileSize != sizeof(SegmentHeader) + header.capacity * sizeof(T) ||
+			header.read > header.written || header.written > header.capacity || (!last && header.written != header.capacity))
+		{
+			throw std::runtime_error("DurableConcurrentQueue segment file is damaged.");
+		}
+		nextIndex = header.index + 1;
+
+		// The queue stopped before it got round to deleting a segment that had been read to the end.
+		if (header.read == header.capacity)
+		{
+			segment.reset();
+			std::filesystem::remove(path);
+			continue;
+		}
+
+		// Segments between the head and the tail are unmapped again right away.
+		numElements += static_cast<size_t>(header.written - header.read);
+		if (m_headSegment == nullptr)
+		{
+			m_headSegment = segment;
+		}
+		if (last)
+		{
+			m_tailSegment = segment;
+		}
+	}
+
+	if (m_tailSegment == nullptr)
+	{
+		m_tailSegment = std::make_shared<Segment>(SegmentPath(nextIndex), nextIndex, m_segmentCapacity);
+	}
+	if (m_headSegment == nullptr)
+	{
+		m_headSegment = m_tailSegment;
+	}
+
+	m_pushCount.store(numElements);
+}
+
+template<typename T>
+inline void DurableConcurrentQueue<T>::PopFront(T& result)
+{
+	// The next segment file is created before any of its elements are counted, so it exists at this point.
+	if (m_headSegment->Header().read == m_headSegment->Header().capacity)
+	{
+		AdvanceHeadSegment();
+	}
+
+	SegmentHeader& header = m_headSegment->Header();
+	result = m_headSegment->Elements()[header.read];
+
+	// Like in Push, a killed process must not count the element as read before it has been copied out.
+	std::atomic_signal_fence(std::memory_order_release);
+	++header.read;
+	++m_popCount;
+
+	// Delete a segment as soon as it has been read to the end, unless producers are still on it. The element has
+	// been popped already, so if the next segment cannot be opened now the next pop tries again.
+	if (header.read == header.capacity)
+	{
+		try
+		{
+			AdvanceHeadSegment();
+		}
+		catch (const std::exception&)
+		{
+		}
+	}
+}
+
+template<typename T>
+inline size_t DurableConcurrentQueue<T>::AvailableToPop() const
+{
+	// Elements counted by the push count have been written before the count was advanced.
+	return m_pushCount.load() - m_popCount.load(std::memory_order_relaxed);
+}
+
+template<typename T>
+inline bool DurableConcurrentQueue<T>::AdvanceHeadSegment()
+{
+	uint64_t nextIndex = m_headSegment->Header().index + 1;
+	std::shared_ptr<Segment> nextSegment;
+
+	// Consumers may take the tail lock while holding the head lock, never the other way around.
+	{
+		std::lock_guard<std::mutex> tailLock(m_tailMutex);
+		if (m_tailSegment == m_headSegment)
+		{
+			return false;
+		}
+		if (m_tailSegment->Header().index == nextIndex)
+		{
+			nextSegment = m_tailSegment;
+		}
+	}
+
+	// Segments between the head and the tail are not mapped.
+	if (nextSegment == nullptr)
+	{
+		std::filesystem::path nextPath = SegmentPath(nextIndex);
+		nextSegment = std::make_shared<Segment>(nextPath, static_cast<size_t>(std::filesystem::file_size(nextPath)));
+	}
+
+	// The file is unmapped before it is deleted, which Windows requires. If deleting it fails the next queue opened
+	// on the directory deletes it, since it has been read to the end.
+	std::filesystem::path drainedPath = m_headSegment->Path();
+	m_headSegment = std::move(nextSegment);
+
+	std::error_code error;
+	std::filesystem::remove(drainedPath, error);
+	return true;
+}
+
+template<typename T>
+inline DurableConcurrentQueue<T>::DirectoryLock::DirectoryLock(const std::filesystem::path& directory)
+{
+	// The lock file itself is never removed, only the lock on it tells whether a queue has the directory open. The
+	// lock goes away with the process that held it, so a crashed queue does not keep the directory locked.
+	std::filesystem::path path = directory / "queue.lock";
+
+#if defined(_WIN32)
+	m_file = ::CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		throw std::system_error(static_cast<int>(::GetLastError()), std::system_category(), "CreateFile");
+	}
+
+	OVERLAPPED overlapped = {};
+	if (!::LockFileEx(m_file, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &overlapped))
+	{
+		DWORD error = ::GetLastError();
+		::CloseHandle(m_file);
+		if (error == ERROR_LOCK_VIOLATION)
+		{
+			throw std::runtime_error("DurableConcurrentQueue directory is open in another queue.");
+		}
+		throw std::system_error(static_cast<int>(error), std::system_category(), "LockFileEx");
+	}
+#else
+	m_handle = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (m_handle == -1)
+	{
+		throw std::system_error(errno, std::system_category(), "open");
+	}
+
+	// Every open of the file gets its own lock, so a second queue in the same process is turned away too.
+	if (::flock(m_handle, LOCK_EX | LOCK_NB) == -1)
+	{
+		int error = errno;
+		::close(m_handle);
+		if (error == EWOULDBLOCK)
+		{
+			throw std::runtime_error("DurableConcurrentQueue directory is open in another queue.");
+		}
+		throw std::system_error(error, std::system_category(), "flock");
+	}
+#endif
+}
+
+template<typename T>
+inline DurableConcurrentQueue<T>::DirectoryLock::~DirectoryLock()
+{
+	// Closing the file releases the lock.
+#if defined(_WIN32)
+	::CloseHandle(m_file);
+#else
+	::close(m_handle);
+#endif
+}
+
+template<typename T>
+inline DurableConcurrentQueue<T>::Segment::Segment(const std::filesystem::path& path, uint64_t index, uint64_t capacity) :
+	m_path(path), m_region(nullptr), m_regionSize(sizeof(SegmentHeader) + static_cast<size_t>(capacity) * sizeof(T))
+{
+	Map(true);
+
+	// A new file reads as zeros, so only the fields that start out non zero need to be written.
+	SegmentHeader& header = Header();
+	header.index = index;
+	header.capacity = capacity;
+	header.elementSize = sizeof(T);
+	std::atomic_signal_fence(std::memory_order_release);
+	header.magic = Magic;
+
+	// Without this a crash of the machine could lose the file while keeping a later one, leaving a gap.
+	Flush();
+	SyncDirectory(m_path.parent_path());
+}
+
+template<typename T>
+inline DurableConcurrentQueue<T>::Segment::Segment(const std::filesystem::path& path, size_t fileSize) :
+	m_path(path), m_region(nullptr), m_regionSize(fileSize)
+{
+	Map(false);
+}
+
+template<typename T>
+inline DurableConcurrentQueue<T>::Segment::~Segment()
+{
+	// Unmapping leaves the written pages to the operating system, which writes them back in its own time.
+#if defined(_WIN32)
+	::UnmapViewOfFile(m_region);
+	::CloseHandle(m_mapping);
+	::CloseHandle(m_file);
+#else
+	::munmap(m_region, m_regionSize);
+#endif
+}
+
+template<typename T>
+inline void DurableConcurrentQueue<T>::Segment::Flush() const
+{
+#if defined(_WIN32)
+	if (!::FlushViewOfFile(m_region, m_regionSize) || !::FlushFileBuffers(m_file))
+	{
+		throw std::system_error(static_cast<int>(::GetLastError()), std::system_category(), "FlushViewOfFile");
+	}
+#else
+	if (::msync(m_region, m_regionSize, MS_SYNC) == -1)
+	{
+		throw std::system_error(errno, std::system_category(), "msync");
+	}
+#endif
+}
+
+template<typename T>
+inline void DurableConcurrentQueue<T>::Segment::SyncFile(const std::filesystem::path& path)
+{
+#if defined(_WIN32)
+	HANDLE file = ::CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+	BOOL flushed = ::FlushFileBuffers(file);
+	DWORD error = ::GetLastError();
+	::CloseHandle(file);
+	if (!flushed)
+	{
+		throw std::system_error(static_cast<int>(error), std::system_category(), "FlushFileBuffers");
+	}
+#else
+	int handle = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (handle == -1)
+	{
+		return;
+	}
+	int synced = ::fsync(handle);
+	int error = errno;
+	::close(handle);
+	if (synced == -1)
+	{
+		throw std::system_error(error, std::system_category(), "fsync");
+	}
+#endif
+}
+
+template<typename T>
+inline void DurableConcurrentQueue<T>::Segment::SyncDirectory(const std::filesystem::path& directory)
+{
+#if defined(_WIN32)
+	// Only a handle opened for backup semantics can refer to a directory.
+	HANDLE handle = ::CreateFileW(directory.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		throw std::system_error(static_cast<int>(::GetLastError()), std::system_category(), "CreateFile");
+	}
+	BOOL flushed = ::FlushFileBuffers(handle);
+	DWORD error = ::GetLastError();
+	::CloseHandle(handle);
+	if (!flushed)
+	{
+		throw std::system_error(static_cast<int>(error), std::system_category(), "FlushFileBuffers");
+	}
+#else
+	int handle = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (handle == -1)
+	{
+		throw std::system_error(errno, std::system_category(), "open");
+	}
+	int synced = ::fsync(handle);
+	int error = errno;
+	::close(handle);
+	if (synced == -1)
+	{
+		throw std::system_error(error, std::system_category(), "fsync");
+	}
+#endif
+}
+
+template<typename T>
+inline void DurableConcurrentQueue<T>::Segment::Map(bool create)
+{
+#if defined(_WIN32)
+	m_file = ::CreateFileW(m_path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, create ? CREATE_NEW : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		throw std::system_error(static_cast<int>(::GetLastError()), std::system_category(), "CreateFile");
+	}
+
+	// Mapping a new file with a size extends it with zeros.
+	uint64_t size = m_regionSize;
+	m_mapping = ::CreateFileMappingW(m_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+	m_region = m_mapping == nullptr ? nullptr : ::MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, m_regionSize);
+	if (m_region == nullptr)
+	{
+		DWORD error = ::GetLastError();
+		if (m_mapping != nullptr)
+		{
+			::CloseHandle(m_mapping);
+		}
+		::CloseHandle(m_file);
+		if (create)
+		{
+			::DeleteFileW(m_path.c_str());
+		}
+		throw std::system_error(static_cast<int>(error), std::system_category(), "MapViewOfFile");
+	}
+#else
+	int handle = create ? ::open(m_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600) : ::open(m_path.c_str(), O_RDWR | O_CLOEXEC);
+	if (handle == -1)
+	{
+		throw std::system_error(errno, std::system_category(), "open");
+	}
+
+	// A new file reads as zeros.
+	if (create && ::ftruncate(handle, static_cast<off_t>(m_regionSize)) == -1)
+	{
+		int error = errno;
+		::close(handle);
+		::unlink(m_path.c_str());
+		throw std::system_error(error, std::system_category(), "ftruncate");
+	}
+
+	m_region = ::mmap(nullptr, m_regionSize, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+	int error = errno;
+	::close(handle);
+	if (m_region == MAP_FAILED)
+	{
+		m_region = nullptr;
+		if (create)
+		{
+			::unlink(m_path.c_str());
+		}
+		throw std::system_error(error, std::system_category(), "mmap");
+	}
+#endif
+}
@@ -0,0 +1,276 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <type_traits>
+#include <utility>
+#include <new>
+
+// Unbounded queue that stores its elements inline in fixed size segments rather than in one node per element.
+//
+// Producers fill the tail segment under the tail lock and link a new segment only when it is full. Consumers
+// empty the head segment under the head lock and move on to the next segment once it is drained. As in
+// ConcurrentQueue, producers publish elements by advancing a push count and consumers compare it with their
+// pop count, so consumers never need the tail lock. A drained segment is parked in a single spare slot and
+// reused by the next producer that needs a segment, so a queue that stays around a steady size stops allocating.
+template <typename T>
+class SegmentedConcurrentQueue
+{
+public:
+	SegmentedConcurrentQueue();
+	~SegmentedConcurrentQueue();
+
+	SegmentedConcurrentQueue(const SegmentedConcurrentQueue<T>& other) = delete;
+	SegmentedConcurrentQueue<T>& operator=(const SegmentedConcurrentQueue<T>& other) = delete;
+
+	SegmentedConcurrentQueue(SegmentedConcurrentQueue<T>&& other) = delete;
+	SegmentedConcurrentQueue<T>& operator=(SegmentedConcurrentQueue<T>&& other) = delete;
+
+	void Push(const T& value);
+	void Push(T&& value);
+
+	bool TryPop(T& result);
+	bool WaitAndPop(T& result);
+
+	// Lock free. Exact when no other thread is pushing or popping.
+	size_t SizeApprox() const;
+	bool Empty() const;
+
+private:
+	enum : size_t { SegmentSize = 256 };
+
+	// Number of attempts a waiting pop makes before it parks on the condition variable.
+	enum : size_t { SpinCount = 64 };
+
+	struct Segment
+	{
+		Segment() : next(nullptr) {}
+
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type slots[SegmentSize];
+		Segment* next;
+
+		T& Data(size_t index) { return *reinterpret_cast<T*>(&slots[index]); }
+	};
+
+	// Construct an element at the back of the queue.
+	template<typename TValue>
+	void PushValue(TValue&& value);
+
+	// Move the front element into 'result' and destroy it. The head lock must be held and the queue must not be empty.
+	void PopFront(T& result);
+
+	// Number of elements in the queue as seen by a consumer. The head lock must be held.
+	size_t AvailableToPop() const;
+
+	// Take the spare segment if there is one, otherwise allocate a new segment.
+	Segment* AcquireSegment();
+
+	// Park a drained segment for reuse, freeing whichever segment was parked before.
+	void RecycleSegment(Segment* segment);
+
+private:
+	Segment* m_headSegment;
+	size_t m_headIndex;
+
+	Segment* m_tailSegment;
+	size_t m_tailIndex;
+
+	mutable std::mutex m_headMutex;
+	mutable std::mutex m_tailMutex;
+
+	std::condition_variable m_notEmptyCondition;
+
+	// Number of consumers parked, or about to park, on the condition variable.
+	std::atomic<size_t> m_sleepingWaiters;
+
+	// Number of elements ever pushed, only advanced under the tail lock once the element is constructed,
+	// and number of elements ever popped, only advanced under the head lock.
+	std::atomic<size_t> m_pushCount;
+	std::atomic<size_t> m_popCount;
+
+	// Handed from consumers to producers without either side taking the other's lock.
+	std::atomic<Segment*> m_spareSegment;
+};
+
+template<typename T>
+inline SegmentedConcurrentQueue<T>::SegmentedConcurrentQueue() :
+	m_headSegment(new Segment()), m_headIndex(0), m_tailSegment(m_headSegment), m_tailIndex(0),
+	m_sleepingWaiters(0), m_pushCount(0), m_popCount(0), m_spareSegment(nullptr)
+{
+}
+
+template<typename T>
+inline SegmentedConcurrentQueue<T>::~SegmentedConcurrentQueue()
+{
+	// Destroy the remaining elements, then free every segment.
+	for (size_t remaining = m_pushCount.load() - m_popCount.load(); remaining > 0; --remaining)
+	{
+		if (m_headIndex == SegmentSize)
+		{
+			m_headSegment = m_headSegment->next;
+			m_headIndex = 0;
+		}
+		m_headSegment->Data(m_headIndex++).~T();
+	}
+
+	while (m_headSegment != nullptr)
+	{
+		Segment* currentSegment = m_headSegment;
+		m_headSegment = m_headSegment->next;
+		delete currentSegment;
+	}
+
+	delete m_spareSegment.load();
+}
+
+template<typename T>
+inline void SegmentedConcurrentQueue<T>::Push(const T& value)
+{
+	PushValue(value);
+}
+
+template<typename T>
+inline void SegmentedConcurrentQueue<T>::Push(T&& value)
+{
+	PushValue(std::move(value));
+}
+
+template<typename T>
+inline bool SegmentedConcurrentQueue<T>::TryPop(T& result)
+{
+	// Fail fast without touching either lock, so idle polling does not slow down anyone else.
+	if (Empty())
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> headLock(m_headMutex);
+
+	// Another consumer may have taken the last element in the meantime.
+	if (AvailableToPop() == 0)
+	{
+		return false;
+	}
+
+	PopFront(result);
+	return true;
+}
+
+template<typename T>
+inline bool SegmentedConcurrentQueue<T>::WaitAndPop(T& result)
+{
+	// An element often arrives shortly after the queue runs dry, so try a few times before paying for parking.
+	for (size_t i = 0; i < SpinCount; ++i)
+	{
+		if (TryPop(result))
+		{
+			return true;
+		}
+	}
+
+	std::unique_lock<std::mutex> headLock(m_headMutex);
+
+	// Register before the predicate is first checked. Both the registration and the push count are sequentially
+	// consistent, so either the check sees a concurrent push or that push sees the registration.
+	++m_sleepingWaiters;
+	m_notEmptyCondition.wait(headLock, [&]() -> bool { return AvailableToPop() != 0; });
+	--m_sleepingWaiters;
+
+	PopFront(result);
+	return true;
+}
+
+template<typename T>
+inline size_t SegmentedConcurrentQueue<T>::SizeApprox() const
+{
+	// Loading the pop count first means the push count read after it can only be larger, so the size never underflows.
+	size_t popCount = m_popCount.load();
+	return m_pushCount.load() - popCount;
+}
+
+template<typename T>
+inline bool SegmentedConcurrentQueue<T>::Empty() const
+{
+	return SizeApprox() == 0;
+}
+
+template<typename T>
+template<typename TValue>
+inline void SegmentedConcurrentQueue<T>::PushValue(TValue&& value)
+{
+	{
+		std::lock_guard<std::mutex> tailLock(m_tailMutex);
+
+		// Link a new segment once the tail segment is full. Consumers only follow the link once an element in
+		// the new segment has been counted, so linking it before constructing the element is safe.
+		if (m_tailIndex == SegmentSize)
+		{
+			Segment* newSegment = AcquireSegment();
+			m_tailSegment->next = newSegment;
+			m_tailSegment = newSegment;
+			m_tailIndex = 0;
+		}
+
+		new (&m_tailSegment->slots[m_tailIndex]) T(std::forward<TValue>(value));
+		++m_tailIndex;
+
+		// Publish the element to consumers.
+		++m_pushCount;
+	}
+
+	// A consumer that registered as sleeping holds the head lock until it is parked, so taking the head lock
+	// before notifying guarantees that the notification cannot slip in between its check and its wait.
+	if (m_sleepingWaiters.load() != 0)
+	{
+		{
+			std::lock_guard<std::mutex> headLock(m_headMutex);
+		}
+		m_notEmptyCondition.notify_one();
+	}
+}
+
+template<typename T>
+inline void SegmentedConcurrentQueue<T>::PopFront(T& result)
+{
+	// The next segment is linked before any of its elements are counted, so it exists at this point.
+	if (m_headIndex == SegmentSize)
+	{
+		Segment* drainedSegment = m_headSegment;
+		m_headSegment = m_headSegment->next;
+		m_headIndex = 0;
+
+		drainedSegment->next = nullptr;
+		RecycleSegment(drainedSegment);
+	}
+
+	// The slot is released even if the data cannot be moved out.
+	T& data = m_headSegment->Data(m_headIndex);
+	struct SlotReleaser
+	{
+		SegmentedConcurrentQueue<T>& queue;
+		T& data;
+		~SlotReleaser() { data.~T(); ++queue.m_headIndex; ++queue.m_popCount; }
+	} slotReleaser{ *this, data };
+
+	result = std::move(data);
+}
+
+template<typename T>
+inline size_t SegmentedConcurrentQueue<T>::AvailableToPop() const
+{
+	return m_pushCount.load() - m_popCount.load(std::memory_order_relaxed);
+}
+
+template<typename T>
+inline typename SegmentedConcurrentQueue<T>::Segment* SegmentedConcurrentQueue<T>::AcquireSegment()
+{
+	Segment* spareSegment = m_spareSegment.exchange(nullptr);
+	return spareSegment != nullptr ? spareSegment : new Segment();
+}
+
+template<typename T>
+inline void SegmentedConcurrentQueue<T>::RecycleSegment(Segment* segment)
+{
+	delete m_spareSegment.exchange(segment);
+}
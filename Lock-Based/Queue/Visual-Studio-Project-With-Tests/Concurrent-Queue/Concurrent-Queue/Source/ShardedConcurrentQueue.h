@@ -0,0 +1,407 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include "ConcurrentQueue.h"
+
+// Unbounded queue made of several independent ConcurrentQueue shards, for when a single head and tail become the
+// bottleneck.
+//
+// Every thread pushes to the same home shard, picked once per thread, so producers on different threads rarely
+// share a lock. A pop samples two shards at random and takes from the fuller one, and falls back to visiting
+// every shard starting at its own home shard, stealing from the others. Every SweepInterval-th pop on the queue
+// instead visits the shards in order starting at the next shard in a round robin, so a lightly loaded shard is
+// not starved by busier ones.
+//
+// The price is a relaxed order. Elements pushed by one thread are popped in the order they were pushed, since
+// they all go through the same FIFO shard. Elements pushed by different threads may be popped out of order, but
+// the round robin bounds how far: an element with p elements ahead of it in its shard is popped within
+// (p + 1) * SweepInterval * NumShards() pop attempts on the queue. A TryPop that races pushes may report the
+// queue as empty while a shard it has already visited receives an element.
+template <typename T>
+class ShardedConcurrentQueue
+{
+public:
+	typedef typename ConcurrentQueue<T>::PopStatus PopStatus;
+
+	// Use 'numShards' shards, or one per hardware thread if zero.
+	explicit ShardedConcurrentQueue(size_t numShards = 0);
+	~ShardedConcurrentQueue() = default;
+
+	ShardedConcurrentQueue(const ShardedConcurrentQueue<T>& other) = delete;
+	ShardedConcurrentQueue<T>& operator=(const ShardedConcurrentQueue<T>& other) = delete;
+
+	ShardedConcurrentQueue(ShardedConcurrentQueue<T>&& other) = delete;
+	ShardedConcurrentQueue<T>& operator=(ShardedConcurrentQueue<T>&& other) = delete;
+
+	// Throws std::logic_error if the queue has been closed.
+	void Push(const T& value);
+
+	std::shared_ptr<T> TryPop();
+	bool TryPop(T& result);
+
+	// Move an element out, or return an empty optional if every shard is empty.
+	std::optional<T> TryPopValue();
+
+	// Return nullptr, false or an empty optional once the queue has been closed and drained.
+	std::shared_ptr<T> WaitAndPop();
+	bool WaitAndPop(T& result);
+	std::optional<T> WaitAndPopValue();
+
+	// Wait for an element until 'timeout' elapses or 'deadline' passes.
+	template<typename TRep, typename TPeriod>
+	PopStatus WaitAndPopFor(T& result, const std::chrono::duration<TRep, TPeriod>& timeout);
+	template<typename TClock, typename TDuration>
+	PopStatus WaitAndPopUntil(T& result, const std::chrono::time_point<TClock, TDuration>& deadline);
+
+	// Reject further pushes and wake every waiting consumer. Elements already in the queue can still be popped.
+	void Close();
+	bool IsClosed() const;
+
+	// Lock free. Exact when no other thread is pushing or popping.
+	size_t SizeApprox() const;
+	bool Empty() const;
+
+	size_t NumShards() const;
+
+	// Every this many pops visit the shards in round robin order instead of sampling them, see above.
+	enum : size_t { SweepInterval = 8 };
+
+private:
+	// Number of attempts a waiting pop makes before it parks on the condition variable.
+	enum : size_t { SpinCount = 64 };
+
+	// Shard every push from the calling thread goes to.
+	size_t HomeShard() const;
+
+	size_t RandomShard();
+
+	// Pop from the first shard that is not empty, visiting every shard in turn starting at 'first'.
+	std::optional<T> TryPopFrom(size_t first);
+
+	// Park until an element was popped into 'result', the queue is closed and drained, or 'deadline' passes.
+	template<typename TClock, typename TDuration>
+	PopStatus WaitUntilPopped(std::optional<T>& result, const std::chrono::time_point<TClock, TDuration>* deadline);
+
+private:
+	// Every shard is a separate allocation, so shards do not share cache lines.
+	std::vector<std::unique_ptr<ConcurrentQueue<T>>> m_shards;
+
+	// Only used to park and wake waiting pops.
+	std::mutex m_waitMutex;
+	std::condition_variable m_notEmptyCondition;
+	std::atomic<size_t> m_sleepingWaiters;
+
+	// Counts pop attempts, to pick the ones that follow the round robin.
+	std::atomic<size_t> m_popTicket;
+
+	// Only set while holding the wait lock, so a waiting pop cannot miss it between its check and its wait.
+	std::atomic<bool> m_closed;
+};
+
+template<typename T>
+inline ShardedConcurrentQueue<T>::ShardedConcurrentQueue(size_t numShards) : m_sleepingWaiters(0), m_popTicket(0), m_closed(false)
+{
+	if (numShards == 0)
+	{
+		numShards = std::max<size_t>(1, std::thread::hardware_concurrency());
+	}
+
+	for (size_t i = 0; i < numShards; ++i)
+	{
+		m_shards.emplace_back(new ConcurrentQueue<T>());
+	}
+}
+
+template<typename T>
+inline void ShardedConcurrentQueue<T>::Push(const T& value)
+{
+	// The shard rejects the element under its own lock once it is closed, see Close.
+	m_shards[HomeShard()]->Push(value);
+
+	// Pairs with the registration of a sleeping pop, so either that pop sees the element or this sees the
+	// registration. Taking the wait lock means the pop is parked before it is notified.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_sleepingWaiters.load(std::memory_order_relaxed) != 0)
+	{
+		{
+			std::lock_guard<std::mutex> waitLock(m_waitMutex);
+		}
+		m_notEmptyCondition.notify_one();
+	}
+}
+
+template<typename T>
+inline std::shared_ptr<T> ShardedConcurrentQueue<T>::TryPop()
+{
+	std::optional<T> result = TryPopValue();
+	if (!result)
+	{
+		return std::shared_ptr<T>();
+	}
+
+	return std::make_shared<T>(std::move(*result));
+}
+
+template<typename T>
+inline bool ShardedConcurrentQueue<T>::TryPop(T& result)
+{
+	std::optional<T> popped = TryPopValue();
+	if (!popped)
+	{
+		return false;
+	}
+
+	result = std::move(*popped);
+	return true;
+}
+
+template<typename T>
+inline std::optional<T> ShardedConcurrentQueue<T>::TryPopValue()
+{
+	size_t numShards = m_shards.size();
+	if (numShards == 1)
+	{
+		return m_shards[0]->TryPopValue();
+	}
+
+	// Every SweepInterval-th pop starts at the next shard in the round robin, which bounds how long the front of a
+	// lightly loaded shard can be passed over.
+	size_t ticket = m_popTicket.fetch_add(1, std::memory_order_relaxed);
+	if (ticket % SweepInterval == 0)
+	{
+		return TryPopFrom((ticket / SweepInterval) % numShards);
+	}
+
+	// Two random choices spread the consumers over the shards and drain the fuller shards first.
+	size_t first = RandomShard();
+	size_t second = RandomShard();
+	if (second == first)
+	{
+		second = (first + 1) % numShards;
+	}
+	if (m_shards[second]->SizeApprox() > m_shards[first]->SizeApprox())
+	{
+		std::swap(first, second);
+	}
+
+	std::optional<T> result = m_shards[first]->TryPopValue();
+	if (!result)
+	{
+		result = m_shards[second]->TryPopValue();
+	}
+	if (result)
+	{
+		return result;
+	}
+
+	// Both picks were empty, which happens when few elements are left, so visit every shard in turn.
+	// Starting at the home shard keeps a thread that both pushes and pops on its own shard when it can.
+	return TryPopFrom(HomeShard());
+}
+
+template<typename T>
+inline std::shared_ptr<T> ShardedConcurrentQueue<T>::WaitAndPop()
+{
+	std::optional<T> result = WaitAndPopValue();
+	if (!result)
+	{
+		return std::shared_ptr<T>();
+	}
+
+	return std::make_shared<T>(std::move(*result));
+}
+
+template<typename T>
+inline bool ShardedConcurrentQueue<T>::WaitAndPop(T& result)
+{
+	std::optional<T> popped = WaitAndPopValue();
+	if (!popped)
+	{
+		return false;
+	}
+
+	result = std::move(*popped);
+	return true;
+}
+
+template<typename T>
+inline std::optional<T> ShardedConcurrentQueue<T>::WaitAndPopValue()
+{
+	std::optional<T> result;
+	WaitUntilPopped<std::chrono::steady_clock, std::chrono::steady_clock::duration>(result, nullptr);
+	return result;
+}
+
+template<typename T>
+template<typename TRep, typename TPeriod>
+inline typename ShardedConcurrentQueue<T>::PopStatus ShardedConcurrentQueue<T>::WaitAndPopFor(T& result, const std::chrono::duration<TRep, TPeriod>& timeout)
+{
+	return WaitAndPopUntil(result, std::chrono::steady_clock::now() + timeout);
+}
+
+template<typename T>
+template<typename TClock, typename TDuration>
+inline typename ShardedConcurrentQueue<T>::PopStatus ShardedConcurrentQueue<T>::WaitAndPopUntil(T& result, const std::chrono::time_point<TClock, TDuration>& deadline)
+{
+	std::optional<T> popped;
+	PopStatus status = WaitUntilPopped(popped, &deadline);
+	if (popped)
+	{
+		result = std::move(*popped);
+	}
+
+	return status;
+}
+
+template<typename T>
+inline void ShardedConcurrentQueue<T>::Close()
+{
+	// Once a shard is closed, a push to it has either completed or throws, so a waiting pop that sees the queue
+	// closed below also sees every element that made it in.
+	for (const std::unique_ptr<ConcurrentQueue<T>>& shard : m_shards)
+	{
+		shard->Close();
+	}
+
+	{
+		std::lock_guard<std::mutex> waitLock(m_waitMutex);
+		m_closed.store(true);
+	}
+	m_notEmptyCondition.notify_all();
+}
+
+template<typename T>
+inline bool ShardedConcurrentQueue<T>::IsClosed() const
+{
+	return m_closed.load();
+}
+
+template<typename T>
+inline size_t ShardedConcurrentQueue<T>::SizeApprox() const
+{
+	size_t size = 0;
+	for (const std::unique_ptr<ConcurrentQueue<T>>& shard : m_shards)
+	{
+		size += shard->SizeApprox();
+	}
+
+	return size;
+}
+
+template<typename T>
+inline bool ShardedConcurrentQueue<T>::Empty() const
+{
+	for (const std::unique_ptr<ConcurrentQueue<T>>& shard : m_shards)
+	{
+		if (!shard->Empty())
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+template<typename T>
+inline size_t ShardedConcurrentQueue<T>::NumShards() const
+{
+	return m_shards.size();
+}
+
+template<typename T>
+inline size_t ShardedConcurrentQueue<T>::HomeShard() const
+{
+	// Threads are numbered in the order they first use any sharded queue, which spreads them evenly.
+	static std::atomic<size_t> nextThreadNumber(0);
+	thread_local size_t threadNumber = nextThreadNumber++;
+	return threadNumber % m_shards.size();
+}
+
+template<typename T>
+inline size_t ShardedConcurrentQueue<T>::RandomShard()
+{
+	// Xorshift, seeded differently on every thread. Quality does not matter, only speed and spread.
+	thread_local uint32_t state = static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state % m_shards.size();
+}
+
+template<typename T>
+inline std::optional<T> ShardedConcurrentQueue<T>::TryPopFrom(size_t first)
+{
+	size_t numShards = m_shards.size();
+	for (size_t i = 0; i < numShards; ++i)
+	{
+		std::optional<T> result = m_shards[(first + i) % numShards]->TryPopValue();
+		if (result)
+		{
+			return result;
+		}
+	}
+
+	return std::optional<T>();
+}
+
+template<typename T>
+template<typename TClock, typename TDuration>
+inline typename ShardedConcurrentQueue<T>::PopStatus ShardedConcurrentQueue<T>::WaitUntilPopped(std::optional<T>& result, const std::chrono::time_point<TClock, TDuration>* deadline)
+{
+	// An element often arrives shortly after the queue runs dry, so try a few times before paying for parking.
+	for (size_t i = 0; i < SpinCount; ++i)
+	{
+		result = TryPopValue();
+		if (result)
+		{
+			return PopStatus::Success;
+		}
+	}
+
+	std::unique_lock<std::mutex> waitLock(m_waitMutex);
+
+	// Register before the predicate is first checked, see Push.
+	++m_sleepingWaiters;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	auto poppedOrClosed = [&]() -> bool
+	{
+		result = TryPopValue();
+		return result || m_closed.load();
+	};
+
+	if (deadline == nullptr)
+	{
+		m_notEmptyCondition.wait(waitLock, poppedOrClosed);
+	}
+	else
+	{
+		m_notEmptyCondition.wait_until(waitLock, *deadline, poppedOrClosed);
+	}
+	--m_sleepingWaiters;
+
+	if (result)
+	{
+		return PopStatus::Success;
+	}
+
+	// Elements pushed before the queue was closed may have been missed by the last check.
+	if (m_closed.load())
+	{
+		result = TryPopValue();
+		return result ? PopStatus::Success : PopStatus::Closed;
+	}
+
+	return PopStatus::Timeout;
+}
@@ -1,12 +1,38 @@
 #include "pch.h"
 #include "CppUnitTest.h"
 #include "../Concurrent-Queue/Source/ConcurrentQueue.h"
+#include "../Concurrent-Queue/Source/SegmentedConcurrentQueue.h"
+#include "../Concurrent-Queue/Source/ShardedConcurrentQueue.h"
+#include "../Concurrent-Queue/Source/DurableConcurrentQueue.h"
 #include <vector>
 #include <thread>
 #include <future>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <iterator>
+#include <optional>
+#include <mutex>
+#include <exception>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+
+#if defined(__linux__)
+#include <poll.h>
+#endif
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
+#if defined(__linux__)
+// Return true if 'handle' becomes readable within 'timeoutMilliseconds'.
+bool IsReadable(int handle, int timeoutMilliseconds)
+{
+	pollfd pollHandle = { handle, POLLIN, 0 };
+	return ::poll(&pollHandle, 1, timeoutMilliseconds) == 1 && (pollHandle.revents & POLLIN) != 0;
+}
+#endif
+
 ConcurrentQueue<int> g_concurrentQueue;
 std::vector<std::thread> g_threads;
 
@@ -16,6 +42,33 @@ auto PopRefFromConcurrentQueue = [](ConcurrentQueue<int>& concurrentQueue, int&
 auto WaitPopPtrFromConcurrentQueue = [](ConcurrentQueue<int>& concurrentQueue) -> std::shared_ptr<int> { return concurrentQueue.WaitAndPop(); };
 auto WaitPopRefFromConcurrentQueue = [](ConcurrentQueue<int>& concurrentQueue, int& result) -> bool { return concurrentQueue.WaitAndPop(result); };
 
+#if CONCURRENT_QUEUE_COROUTINES
+// Coroutine that starts right away and destroys itself once it finishes.
+struct DetachedCoroutine
+{
+	struct promise_type
+	{
+		DetachedCoroutine get_return_object() { return DetachedCoroutine(); }
+		std::suspend_never initial_suspend() { return std::suspend_never(); }
+		std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+// Pop integers until the queue is closed and drained, then count itself as finished.
+template<typename TExecutor>
+DetachedCoroutine ConsumeAsync(ConcurrentQueue<int>& concurrentQueue, TExecutor executor, std::mutex& mutex, std::vector<int>& integersPoped, std::atomic<int>& numFinished)
+{
+	while (std::optional<int> integer = co_await concurrentQueue.PopAsync(executor))
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		integersPoped.push_back(*integer);
+	}
+	++numFinished;
+}
+#endif
+
 namespace Tests
 {
 	TEST_CLASS(Tests)
@@ -153,5 +206,898 @@ namespace Tests
 				}
 			}
 		}
+
+		TEST_METHOD(ParkedWaitersWakeOnPushMethod)
+		{
+			size_t numWaiters = 8;
+
+			ConcurrentQueue<int> concurrentQueue;
+			std::vector<int> integersPushed;
+			std::vector<std::future<std::shared_ptr<int>>> futures;
+
+			// Launch all waiting threads and give them time to spin out and park.
+			for (size_t i = 0; i < numWaiters; ++i)
+			{
+				futures.push_back(std::async(std::launch::async, WaitPopPtrFromConcurrentQueue, std::ref(concurrentQueue)));
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+			// Each push wakes a single waiter, so every waiter must still receive exactly one integer.
+			for (size_t i = 0; i < numWaiters; ++i)
+			{
+				concurrentQueue.Push(static_cast<int>(i));
+				integersPushed.push_back(static_cast<int>(i));
+			}
+
+			for (std::future<std::shared_ptr<int>>& future : futures)
+			{
+				int integer = *(future.get());
+				Assert::IsTrue(std::find(integersPushed.begin(), integersPushed.end(), integer) != integersPushed.end());
+				integersPushed.erase(std::remove(integersPushed.begin(), integersPushed.end(), integer), integersPushed.end());
+			}
+			Assert::IsTrue(concurrentQueue.Empty());
+		}
+
+		TEST_METHOD(WaitAndPopForTimeoutMethod)
+		{
+			ConcurrentQueue<int> concurrentQueue;
+			int integer = -1;
+
+			// Nothing is pushed so the wait runs into its deadline.
+			auto start = std::chrono::steady_clock::now();
+			Assert::IsTrue(concurrentQueue.WaitAndPopFor(integer, std::chrono::milliseconds(20)) == ConcurrentQueue<int>::PopStatus::Timeout);
+			Assert::IsTrue(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+
+			// An element pushed before the deadline is returned.
+			std::thread pushThread(PushToConcurrentQueue, std::ref(concurrentQueue), 7);
+			Assert::IsTrue(concurrentQueue.WaitAndPopUntil(integer, std::chrono::steady_clock::now() + std::chrono::seconds(10)) == ConcurrentQueue<int>::PopStatus::Success);
+			Assert::AreEqual(7, integer);
+			pushThread.join();
+		}
+
+		TEST_METHOD(CloseWakesWaitersMethod)
+		{
+			size_t numWaiters = 4;
+
+			ConcurrentQueue<int> concurrentQueue;
+			std::vector<std::future<bool>> waitPopFutures;
+			std::vector<std::future<ConcurrentQueue<int>::PopStatus>> timedPopFutures;
+			std::vector<int> integersPoped(numWaiters);
+
+			for (size_t i = 0; i < numWaiters; ++i)
+			{
+				waitPopFutures.push_back(std::async(std::launch::async, WaitPopRefFromConcurrentQueue, std::ref(concurrentQueue), std::ref(integersPoped[i])));
+				timedPopFutures.push_back(std::async(std::launch::async, [&]() -> ConcurrentQueue<int>::PopStatus
+				{
+					int integer;
+					return concurrentQueue.WaitAndPopFor(integer, std::chrono::seconds(60));
+				}));
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+			// Closing wakes every waiter long before its deadline.
+			concurrentQueue.Close();
+			Assert::IsTrue(concurrentQueue.IsClosed());
+
+			for (std::future<bool>& future : waitPopFutures)
+			{
+				Assert::IsFalse(future.get());
+			}
+			for (std::future<ConcurrentQueue<int>::PopStatus>& future : timedPopFutures)
+			{
+				Assert::IsTrue(future.get() == ConcurrentQueue<int>::PopStatus::Closed);
+			}
+		}
+
+		TEST_METHOD(CloseDrainsRemainingElementsMethod)
+		{
+			ConcurrentQueue<int> concurrentQueue;
+			concurrentQueue.Push(1);
+			concurrentQueue.Push(2);
+			concurrentQueue.Close();
+
+			// Pushing to a closed queue is rejected.
+			bool threw = false;
+			try
+			{
+				concurrentQueue.Push(3);
+			}
+			catch (const std::logic_error&)
+			{
+				threw = true;
+			}
+			Assert::IsTrue(threw);
+
+			// Elements pushed before the close are still handed out, then the closed status is reported.
+			int integer = -1;
+			Assert::IsTrue(concurrentQueue.WaitAndPopFor(integer, std::chrono::seconds(1)) == ConcurrentQueue<int>::PopStatus::Success);
+			Assert::AreEqual(1, integer);
+			Assert::IsTrue(concurrentQueue.WaitAndPop(integer));
+			Assert::AreEqual(2, integer);
+			Assert::IsTrue(concurrentQueue.WaitAndPopFor(integer, std::chrono::seconds(1)) == ConcurrentQueue<int>::PopStatus::Closed);
+			Assert::IsTrue(concurrentQueue.WaitAndPop() == nullptr);
+		}
+
+		TEST_METHOD(PushRacingCloseMethod)
+		{
+			size_t numRounds = 200;
+			size_t numConsumers = 2;
+
+			// Every push that was accepted must be popped, even when it races the close that wakes the consumers.
+			for (size_t round = 0; round < numRounds; ++round)
+			{
+				ConcurrentQueue<int> concurrentQueue;
+				std::vector<std::future<size_t>> consumers;
+				for (size_t i = 0; i < numConsumers; ++i)
+				{
+					consumers.push_back(std::async(std::launch::async, [&]() -> size_t
+					{
+						size_t numPoped = 0;
+						int integer;
+						while (concurrentQueue.WaitAndPop(integer))
+						{
+							++numPoped;
+						}
+						return numPoped;
+					}));
+				}
+
+				std::future<size_t> producer = std::async(std::launch::async, [&]() -> size_t
+				{
+					size_t numPushed = 0;
+					try
+					{
+						while (true)
+						{
+							concurrentQueue.Push(static_cast<int>(numPushed));
+							++numPushed;
+						}
+					}
+					catch (const std::logic_error&)
+					{
+					}
+					return numPushed;
+				});
+
+				std::this_thread::sleep_for(std::chrono::microseconds(round % 50));
+				concurrentQueue.Close();
+
+				size_t numPushed = producer.get();
+				size_t numPoped = 0;
+				for (std::future<size_t>& consumer : consumers)
+				{
+					numPoped += consumer.get();
+				}
+				Assert::AreEqual(numPushed, numPoped);
+				Assert::IsTrue(concurrentQueue.Empty());
+			}
+		}
+
+		TEST_METHOD(PushBulkPopBulkMethod)
+		{
+			ConcurrentQueue<int> concurrentQueue;
+			std::vector<int> integersPushed = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+			std::vector<int> integersPoped;
+
+			concurrentQueue.PushBulk(integersPushed.begin(), integersPushed.begin() + 5);
+			concurrentQueue.Push(5);
+			concurrentQueue.PushBulk(integersPushed.begin() + 6, integersPushed.end());
+
+			// Elements come out in the order they were pushed, at most 'maxCount' at a time.
+			Assert::AreEqual(static_cast<size_t>(4), concurrentQueue.PopBulk(std::back_inserter(integersPoped), 4));
+			Assert::AreEqual(static_cast<size_t>(6), concurrentQueue.PopBulk(std::back_inserter(integersPoped), 100));
+			Assert::AreEqual(static_cast<size_t>(0), concurrentQueue.PopBulk(std::back_inserter(integersPoped), 100));
+			Assert::IsTrue(integersPoped == integersPushed);
+			Assert::IsTrue(concurrentQueue.Empty());
+		}
+
+		TEST_METHOD(PopBulkForLingerMethod)
+		{
+			ConcurrentQueue<int> concurrentQueue;
+			std::vector<int> integersPoped;
+
+			// Only part of the batch arrives, so the pop returns what it has once the linger time is up.
+			concurrentQueue.Push(1);
+			Assert::AreEqual(static_cast<size_t>(1), concurrentQueue.PopBulkFor(std::back_inserter(integersPoped), 4, std::chrono::milliseconds(20)));
+
+			// Elements trickling in while lingering are collected into the same batch.
+			std::thread pushThread([&]() -> void
+			{
+				for (int i = 2; i <= 4; ++i)
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(5));
+					concurrentQueue.Push(i);
+				}
+			});
+			Assert::AreEqual(static_cast<size_t>(3), concurrentQueue.PopBulkFor(std::back_inserter(integersPoped), 3, std::chrono::seconds(10)));
+			pushThread.join();
+
+			Assert::IsTrue(integersPoped == std::vector<int>({ 1, 2, 3, 4 }));
+		}
+
+		TEST_METHOD(MoveOnlyPushAndEmplaceMethod)
+		{
+			// Move only elements are stored in the nodes and moved in and out without copies.
+			ConcurrentQueue<std::unique_ptr<int>> concurrentQueue;
+			Assert::IsFalse(concurrentQueue.TryPopValue().has_value());
+
+			concurrentQueue.Push(std::unique_ptr<int>(new int(0)));
+			concurrentQueue.Emplace(new int(1));
+			concurrentQueue.Emplace(new int(2));
+			concurrentQueue.Emplace(new int(3));
+
+			std::optional<std::unique_ptr<int>> integerPtr = concurrentQueue.TryPopValue();
+			Assert::IsTrue(integerPtr.has_value() && **integerPtr == 0);
+
+			std::unique_ptr<int> integer;
+			Assert::IsTrue(concurrentQueue.TryPop(integer));
+			Assert::AreEqual(1, *integer);
+
+			integerPtr = concurrentQueue.WaitAndPopValue();
+			Assert::IsTrue(integerPtr.has_value() && **integerPtr == 2);
+
+			// Elements left behind are destroyed with the queue, waiting pops see the close once it is drained.
+			concurrentQueue.Close();
+			Assert::IsTrue(concurrentQueue.WaitAndPop(integer));
+			Assert::AreEqual(3, *integer);
+			Assert::IsFalse(concurrentQueue.WaitAndPopValue().has_value());
+
+			ConcurrentQueue<std::unique_ptr<int>> abandonedQueue;
+			std::vector<std::unique_ptr<int>> integerPtrs;
+			integerPtrs.emplace_back(new int(0));
+			integerPtrs.emplace_back(new int(1));
+			abandonedQueue.PushBulk(std::make_move_iterator(integerPtrs.begin()), std::make_move_iterator(integerPtrs.end()));
+			Assert::AreEqual(static_cast<size_t>(2), abandonedQueue.SizeApprox());
+		}
+
+		TEST_METHOD(SizeApproxMethod)
+		{
+			size_t numProducers = 4;
+			int numIntegersPerProducer = 1000;
+
+			ConcurrentQueue<int> concurrentQueue;
+			Assert::AreEqual(static_cast<size_t>(0), concurrentQueue.SizeApprox());
+
+			std::vector<std::future<void>> producers;
+			for (size_t i = 0; i < numProducers; ++i)
+			{
+				producers.push_back(std::async(std::launch::async, [&]() -> void
+				{
+					for (int j = 0; j < numIntegersPerProducer; ++j)
+					{
+						concurrentQueue.Push(j);
+					}
+				}));
+			}
+
+			// Polling an empty or changing queue never reports more elements than were pushed.
+			int integer;
+			size_t numPoped = 0;
+			while (numPoped < numProducers * numIntegersPerProducer)
+			{
+				Assert::IsTrue(concurrentQueue.SizeApprox() <= numProducers * numIntegersPerProducer - numPoped);
+				if (concurrentQueue.TryPop(integer))
+				{
+					++numPoped;
+				}
+			}
+
+			for (std::future<void>& producer : producers)
+			{
+				producer.get();
+			}
+
+			// Once every thread is done the size is exact.
+			Assert::AreEqual(static_cast<size_t>(0), concurrentQueue.SizeApprox());
+			Assert::IsTrue(concurrentQueue.Empty());
+			concurrentQueue.Push(1);
+			concurrentQueue.Push(2);
+			Assert::AreEqual(static_cast<size_t>(2), concurrentQueue.SizeApprox());
+			Assert::IsFalse(concurrentQueue.Empty());
+		}
+
+		TEST_METHOD(BoundedTryPushAndWaitAndPushMethod)
+		{
+			ConcurrentQueue<int> concurrentQueue(2);
+			Assert::AreEqual(static_cast<size_t>(2), concurrentQueue.Capacity());
+			Assert::AreEqual(static_cast<size_t>(ConcurrentQueue<int>::Unbounded), ConcurrentQueue<int>().Capacity());
+
+			// A full queue rejects pushes that do not wait, and timed pushes run into their deadline.
+			Assert::IsTrue(concurrentQueue.TryPush(1));
+			concurrentQueue.WaitAndPush(2);
+			Assert::IsFalse(concurrentQueue.TryPush(3));
+			auto start = std::chrono::steady_clock::now();
+			Assert::IsFalse(concurrentQueue.WaitAndPushFor(3, std::chrono::milliseconds(20)));
+			Assert::IsTrue(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+
+			// A batch larger than the capacity could never fit.
+			std::vector<int> integers = { 3, 4, 5 };
+			bool threw = false;
+			try
+			{
+				concurrentQueue.PushBulk(integers.begin(), integers.end());
+			}
+			catch (const std::length_error&)
+			{
+				threw = true;
+			}
+			Assert::IsTrue(threw);
+
+			// Blocked producers carry on as consumers make room.
+			std::future<void> blockedPush = std::async(std::launch::async, [&]() -> void { concurrentQueue.WaitAndPush(3); });
+			std::future<bool> blockedTimedPush = std::async(std::launch::async, [&]() -> bool { return concurrentQueue.WaitAndPushFor(4, std::chrono::seconds(60)); });
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			Assert::AreEqual(static_cast<size_t>(2), concurrentQueue.SizeApprox());
+
+			std::vector<int> integersPoped;
+			Assert::AreEqual(static_cast<size_t>(2), concurrentQueue.PopBulk(std::back_inserter(integersPoped), 2));
+			blockedPush.get();
+			Assert::IsTrue(blockedTimedPush.get());
+			int integer;
+			while (integersPoped.size() < 4 && concurrentQueue.WaitAndPop(integer))
+			{
+				integersPoped.push_back(integer);
+			}
+			std::sort(integersPoped.begin(), integersPoped.end());
+			Assert::IsTrue(integersPoped == std::vector<int>({ 1, 2, 3, 4 }));
+
+			// Closing a full queue wakes a blocked producer with the same error as any push to a closed queue.
+			concurrentQueue.Push(5);
+			concurrentQueue.Push(6);
+			std::future<void> rejectedPush = std::async(std::launch::async, [&]() -> void { concurrentQueue.Push(7); });
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			concurrentQueue.Close();
+			threw = false;
+			try
+			{
+				rejectedPush.get();
+			}
+			catch (const std::logic_error&)
+			{
+				threw = true;
+			}
+			Assert::IsTrue(threw);
+			Assert::AreEqual(static_cast<size_t>(2), concurrentQueue.SizeApprox());
+		}
+
+		TEST_METHOD(BoundedContendedBackpressureMethod)
+		{
+			size_t capacity = 8;
+			size_t numProducers = 4;
+			size_t numConsumers = 4;
+			int numIntegersPerProducer = 10000;
+
+			ConcurrentQueue<int> concurrentQueue(capacity);
+			std::atomic<bool> exceededCapacity(false);
+			std::vector<std::future<void>> producers;
+			std::vector<std::future<std::vector<int>>> consumers;
+
+			for (size_t i = 0; i < numProducers; ++i)
+			{
+				producers.push_back(std::async(std::launch::async, [&, i]() -> void
+				{
+					// Mix single and bulk pushes, both have to wait for room.
+					for (int j = 0; j < numIntegersPerProducer; j += 2)
+					{
+						int integer = static_cast<int>(i) * numIntegersPerProducer + j;
+						if (j % 4 == 0)
+						{
+							std::vector<int> integers = { integer, integer + 1 };
+							concurrentQueue.PushBulk(integers.begin(), integers.end());
+						}
+						else
+						{
+							concurrentQueue.WaitAndPush(integer);
+							concurrentQueue.Push(integer + 1);
+						}
+					}
+				}));
+			}
+			for (size_t i = 0; i < numConsumers; ++i)
+			{
+				consumers.push_back(std::async(std::launch::async, [&]() -> std::vector<int>
+				{
+					std::vector<int> integersPoped;
+					int integer;
+					while (concurrentQueue.WaitAndPop(integer))
+					{
+						if (concurrentQueue.SizeApprox() > capacity)
+						{
+							exceededCapacity.store(true);
+						}
+						integersPoped.push_back(integer);
+					}
+					return integersPoped;
+				}));
+			}
+
+			for (std::future<void>& producer : producers)
+			{
+				producer.get();
+			}
+			concurrentQueue.Close();
+
+			std::vector<int> integersPoped;
+			for (std::future<std::vector<int>>& consumer : consumers)
+			{
+				std::vector<int> integersPopedByConsumer = consumer.get();
+				integersPoped.insert(integersPoped.end(), integersPopedByConsumer.begin(), integersPopedByConsumer.end());
+			}
+
+			// The queue never grew past its capacity and every element arrived exactly once.
+			Assert::IsFalse(exceededCapacity.load());
+			std::sort(integersPoped.begin(), integersPoped.end());
+			Assert::AreEqual(numProducers * numIntegersPerProducer, integersPoped.size());
+			for (size_t i = 0; i < integersPoped.size(); ++i)
+			{
+				Assert::AreEqual(static_cast<int>(i), integersPoped[i]);
+			}
+		}
+
+#if defined(__linux__)
+		TEST_METHOD(ReadinessHandleMethod)
+		{
+			ConcurrentQueue<int> concurrentQueue;
+			concurrentQueue.Push(0);
+
+			// Elements pushed before the handle was enabled are signalled right away.
+			int handle = concurrentQueue.EnableReadinessHandle();
+			Assert::AreEqual(handle, concurrentQueue.EnableReadinessHandle());
+			Assert::IsTrue(IsReadable(handle, 0));
+
+			// The reactor resets the handle and then drains the queue.
+			std::vector<int> integersPoped;
+			concurrentQueue.ResetReadiness();
+			Assert::IsFalse(IsReadable(handle, 0));
+			concurrentQueue.PopBulk(std::back_inserter(integersPoped), 100);
+
+			// Pushes from another thread raise the handle once until the next reset.
+			std::thread pushThread([&]() -> void
+			{
+				for (int i = 1; i <= 100; ++i)
+				{
+					concurrentQueue.Push(i);
+				}
+			});
+			while (integersPoped.size() < 101)
+			{
+				Assert::IsTrue(IsReadable(handle, 10000));
+				concurrentQueue.ResetReadiness();
+				concurrentQueue.PopBulk(std::back_inserter(integersPoped), 100);
+			}
+			pushThread.join();
+
+			Assert::IsFalse(IsReadable(handle, 0));
+			for (int i = 0; i <= 100; ++i)
+			{
+				Assert::AreEqual(i, integersPoped[i]);
+			}
+		}
+#endif
+
+#if CONCURRENT_QUEUE_COROUTINES
+		TEST_METHOD(PopAsyncResumesOnPushMethod)
+		{
+			int numCoroutines = 100;
+			int numIntegers = 1000;
+
+			ConcurrentQueue<int> concurrentQueue;
+			std::mutex mutex;
+			std::vector<int> integersPoped;
+			std::atomic<int> numFinished(0);
+
+			// Every coroutine suspends on the empty queue without holding a thread.
+			for (int i = 0; i < numCoroutines; ++i)
+			{
+				ConsumeAsync(concurrentQueue, ConcurrentQueue<int>::InlineExecutor(), mutex, integersPoped, numFinished);
+			}
+
+			// Each push resumes the longest suspended coroutine on this thread, so the integers are popped in order.
+			for (int i = 0; i < numIntegers; ++i)
+			{
+				concurrentQueue.Push(i);
+			}
+			Assert::IsTrue(concurrentQueue.Empty());
+			Assert::AreEqual(0, numFinished.load());
+
+			concurrentQueue.Close();
+			Assert::AreEqual(numCoroutines, numFinished.load());
+
+			Assert::AreEqual(static_cast<size_t>(numIntegers), integersPoped.size());
+			for (int i = 0; i < numIntegers; ++i)
+			{
+				Assert::AreEqual(i, integersPoped[i]);
+			}
+		}
+
+		TEST_METHOD(PopAsyncPostsToExecutorMethod)
+		{
+			size_t numProducers = 4;
+			size_t numWorkers = 2;
+			int numCoroutines = 100;
+			int numIntegersPerProducer = 5000;
+
+			// The executor posts resumed coroutines to a few worker threads.
+			ConcurrentQueue<std::coroutine_handle<>> runQueue;
+			auto executor = [&runQueue](std::coroutine_handle<> handle) -> void { runQueue.Push(handle); };
+			std::vector<std::thread> workers;
+			for (size_t i = 0; i < numWorkers; ++i)
+			{
+				workers.emplace_back([&runQueue]() -> void
+				{
+					while (std::optional<std::coroutine_handle<>> handle = runQueue.WaitAndPopValue())
+					{
+						handle->resume();
+					}
+				});
+			}
+
+			ConcurrentQueue<int> concurrentQueue;
+			std::mutex mutex;
+			std::vector<int> integersPoped;
+			std::atomic<int> numFinished(0);
+			for (int i = 0; i < numCoroutines; ++i)
+			{
+				ConsumeAsync(concurrentQueue, executor, mutex, integersPoped, numFinished);
+			}
+
+			std::vector<std::future<void>> producers;
+			for (size_t i = 0; i < numProducers; ++i)
+			{
+				producers.push_back(std::async(std::launch::async, [&, i]() -> void
+				{
+					for (int j = 0; j < numIntegersPerProducer; ++j)
+					{
+						concurrentQueue.Push(static_cast<int>(i) * numIntegersPerProducer + j);
+					}
+				}));
+			}
+			for (std::future<void>& producer : producers)
+			{
+				producer.get();
+			}
+
+			concurrentQueue.Close();
+			while (numFinished.load() != numCoroutines)
+			{
+				std::this_thread::yield();
+			}
+			runQueue.Close();
+			for (std::thread& worker : workers)
+			{
+				worker.join();
+			}
+
+			// Every integer was popped exactly once.
+			std::sort(integersPoped.begin(), integersPoped.end());
+			Assert::AreEqual(numProducers * numIntegersPerProducer, integersPoped.size());
+			for (size_t i = 0; i < integersPoped.size(); ++i)
+			{
+				Assert::AreEqual(static_cast<int>(i), integersPoped[i]);
+			}
+		}
+#endif
+
+		TEST_METHOD(SegmentedPushAndPopMethod)
+		{
+			int numIntegers = 1000;
+
+			// Move only elements are stored inline, across several segments.
+			SegmentedConcurrentQueue<std::unique_ptr<int>> segmentedQueue;
+			std::unique_ptr<int> integerPtr;
+			Assert::IsFalse(segmentedQueue.TryPop(integerPtr));
+
+			for (int lap = 0; lap < 3; ++lap)
+			{
+				for (int i = 0; i < numIntegers; ++i)
+				{
+					segmentedQueue.Push(std::unique_ptr<int>(new int(i)));
+				}
+				Assert::AreEqual(static_cast<size_t>(numIntegers), segmentedQueue.SizeApprox());
+
+				// Elements come out in the order they were pushed.
+				for (int i = 0; i < numIntegers; ++i)
+				{
+					Assert::IsTrue(segmentedQueue.TryPop(integerPtr));
+					Assert::AreEqual(i, *integerPtr);
+				}
+				Assert::IsTrue(segmentedQueue.Empty());
+			}
+
+			// Elements left behind are destroyed with the queue.
+			segmentedQueue.Push(std::unique_ptr<int>(new int(0)));
+		}
+
+		TEST_METHOD(SegmentedContendedPushAndWaitPopMethod)
+		{
+			size_t numProducers = 4;
+			size_t numConsumers = 4;
+			int numIntegersPerProducer = 5000;
+
+			SegmentedConcurrentQueue<int> segmentedQueue;
+			std::vector<std::future<void>> producers;
+			std::vector<std::future<std::vector<int>>> consumers;
+
+			for (size_t i = 0; i < numProducers; ++i)
+			{
+				producers.push_back(std::async(std::launch::async, [&, i]() -> void
+				{
+					for (int j = 0; j < numIntegersPerProducer; ++j)
+					{
+						segmentedQueue.Push(static_cast<int>(i) * numIntegersPerProducer + j);
+					}
+				}));
+			}
+
+			// Each consumer waits for an equal share of the integers.
+			for (size_t i = 0; i < numConsumers; ++i)
+			{
+				consumers.push_back(std::async(std::launch::async, [&]() -> std::vector<int>
+				{
+					std::vector<int> integersPoped;
+					int integer;
+					for (size_t j = 0; j < numProducers * numIntegersPerProducer / numConsumers; ++j)
+					{
+						segmentedQueue.WaitAndPop(integer);
+						integersPoped.push_back(integer);
+					}
+					return integersPoped;
+				}));
+			}
+
+			for (std::future<void>& producer : producers)
+			{
+				producer.get();
+			}
+
+			// Every integer was popped exactly once.
+			std::vector<int> integersPoped;
+			for (std::future<std::vector<int>>& consumer : consumers)
+			{
+				std::vector<int> consumed = consumer.get();
+				integersPoped.insert(integersPoped.end(), consumed.begin(), consumed.end());
+			}
+
+			std::sort(integersPoped.begin(), integersPoped.end());
+			Assert::AreEqual(numProducers * numIntegersPerProducer, integersPoped.size());
+			for (size_t i = 0; i < integersPoped.size(); ++i)
+			{
+				Assert::AreEqual(static_cast<int>(i), integersPoped[i]);
+			}
+			Assert::IsTrue(segmentedQueue.Empty());
+		}
+
+		TEST_METHOD(ShardedPerProducerOrderMethod)
+		{
+			size_t numProducers = 4;
+			int numIntegersPerProducer = 5000;
+
+			ShardedConcurrentQueue<int> shardedQueue(4);
+			int integer = -1;
+			Assert::IsFalse(shardedQueue.TryPop(integer));
+			Assert::IsTrue(shardedQueue.TryPop() == nullptr);
+
+			std::vector<std::future<void>> producers;
+			for (size_t i = 0; i < numProducers; ++i)
+			{
+				producers.push_back(std::async(std::launch::async, [&, i]() -> void
+				{
+					for (int j = 0; j < numIntegersPerProducer; ++j)
+					{
+						shardedQueue.Push(static_cast<int>(i) * numIntegersPerProducer + j);
+					}
+				}));
+			}
+			for (std::future<void>& producer : producers)
+			{
+				producer.get();
+			}
+			Assert::AreEqual(numProducers * numIntegersPerProducer, shardedQueue.SizeApprox());
+
+			// Order across producers is relaxed, but the integers of each producer come out in the order they were pushed.
+			std::vector<int> lastPoped(numProducers, -1);
+			while (shardedQueue.TryPop(integer))
+			{
+				size_t producer = integer / numIntegersPerProducer;
+				Assert::IsTrue(integer > lastPoped[producer]);
+				lastPoped[producer] = integer;
+			}
+			for (size_t i = 0; i < numProducers; ++i)
+			{
+				Assert::AreEqual(static_cast<int>(i + 1) * numIntegersPerProducer - 1, lastPoped[i]);
+			}
+			Assert::IsTrue(shardedQueue.Empty());
+		}
+
+		TEST_METHOD(ShardedContendedPushAndWaitPopMethod)
+		{
+			size_t numProducers = 4;
+			size_t numConsumers = 4;
+			int numIntegersPerProducer = 5000;
+
+			ShardedConcurrentQueue<int> shardedQueue;
+			std::vector<std::future<void>> producers;
+			std::vector<std::future<std::vector<int>>> consumers;
+
+			// Consumers wait until the queue is closed and drained.
+			for (size_t i = 0; i < numConsumers; ++i)
+			{
+				consumers.push_back(std::async(std::launch::async, [&]() -> std::vector<int>
+				{
+					std::vector<int> integersPoped;
+					int integer;
+					while (shardedQueue.WaitAndPop(integer))
+					{
+						integersPoped.push_back(integer);
+					}
+					return integersPoped;
+				}));
+			}
+
+			for (size_t i = 0; i < numProducers; ++i)
+			{
+				producers.push_back(std::async(std::launch::async, [&, i]() -> void
+				{
+					for (int j = 0; j < numIntegersPerProducer; ++j)
+					{
+						shardedQueue.Push(static_cast<int>(i) * numIntegersPerProducer + j);
+					}
+				}));
+			}
+
+			for (std::future<void>& producer : producers)
+			{
+				producer.get();
+			}
+			shardedQueue.Close();
+
+			// Every integer was popped exactly once.
+			std::vector<int> integersPoped;
+			for (std::future<std::vector<int>>& consumer : consumers)
+			{
+				std::vector<int> consumed = consumer.get();
+				integersPoped.insert(integersPoped.end(), consumed.begin(), consumed.end());
+			}
+
+			std::sort(integersPoped.begin(), integersPoped.end());
+			Assert::AreEqual(numProducers * numIntegersPerProducer, integersPoped.size());
+			for (size_t i = 0; i < integersPoped.size(); ++i)
+			{
+				Assert::AreEqual(static_cast<int>(i), integersPoped[i]);
+			}
+			Assert::IsTrue(shardedQueue.Empty());
+
+			// A drained and closed queue does not wait out the timeout.
+			int integer = -1;
+			Assert::IsTrue(shardedQueue.WaitAndPopFor(integer, std::chrono::seconds(10)) == ShardedConcurrentQueue<int>::PopStatus::Closed);
+		}
+
+		TEST_METHOD(DurableRecoverAfterReopenMethod)
+		{
+			std::filesystem::path directory = std::filesystem::temp_directory_path() / "DurableConcurrentQueueRecoverTest";
+			std::filesystem::remove_all(directory);
+			auto countSegmentFiles = [&]() -> size_t
+			{
+				return static_cast<size_t>(std::count_if(std::filesystem::directory_iterator(directory), std::filesystem::directory_iterator(),
+					[](const std::filesystem::directory_entry& entry) -> bool { return entry.path().extension() == ".dat"; }));
+			};
+
+			int integer = -1;
+			{
+				// Twelve integers fill three segments of four, popping five drains the first one.
+				DurableConcurrentQueue<int> durableQueue(directory.string(), 4);
+				Assert::IsTrue(durableQueue.Empty());
+
+				// A second queue on the same directory is turned away while the first one is open.
+				Assert::ExpectException<std::runtime_error>([&]() -> void { DurableConcurrentQueue<int> otherQueue(directory.string(), 4); });
+
+				for (int i = 0; i < 12; ++i)
+				{
+					durableQueue.Push(i);
+				}
+				Assert::AreEqual(static_cast<size_t>(3), countSegmentFiles());
+
+				for (int i = 0; i < 5; ++i)
+				{
+					Assert::IsTrue(durableQueue.TryPop(integer));
+					Assert::AreEqual(i, integer);
+				}
+				Assert::AreEqual(static_cast<size_t>(2), countSegmentFiles());
+			}
+
+			// The next segment file was being created when the process stopped, it is discarded.
+			std::ofstream(directory / "segment-00000000000000000003.dat").close();
+
+			{
+				// The reopened queue carries on with the integers that were left, in order.
+				DurableConcurrentQueue<int> durableQueue(directory.string(), 4);
+				Assert::AreEqual(static_cast<size_t>(7), durableQueue.SizeApprox());
+				durableQueue.Push(12);
+				durableQueue.Push(13);
+				durableQueue.Flush();
+
+				for (int i = 5; i < 14; ++i)
+				{
+					Assert::IsTrue(durableQueue.WaitAndPop(integer));
+					Assert::AreEqual(i, integer);
+				}
+				Assert::IsFalse(durableQueue.TryPop(integer));
+				Assert::AreEqual(static_cast<size_t>(1), countSegmentFiles());
+			}
+
+			{
+				DurableConcurrentQueue<int> durableQueue(directory.string(), 4);
+				Assert::IsTrue(durableQueue.Empty());
+			}
+
+			std::filesystem::remove_all(directory);
+		}
+
+		TEST_METHOD(DurableContendedPushAndWaitPopMethod)
+		{
+			size_t numProducers = 4;
+			size_t numConsumers = 4;
+			int numIntegersPerProducer = 5000;
+
+			std::filesystem::path directory = std::filesystem::temp_directory_path() / "DurableConcurrentQueueContendedTest";
+			std::filesystem::remove_all(directory);
+
+			{
+				// Small segments make producers and consumers move between segment files all the time.
+				DurableConcurrentQueue<int> durableQueue(directory.string(), 64);
+				std::vector<std::future<void>> producers;
+				std::vector<std::future<std::vector<int>>> consumers;
+
+				for (size_t i = 0; i < numProducers; ++i)
+				{
+					producers.push_back(std::async(std::launch::async, [&, i]() -> void
+					{
+						for (int j = 0; j < numIntegersPerProducer; ++j)
+						{
+							durableQueue.Push(static_cast<int>(i) * numIntegersPerProducer + j);
+						}
+					}));
+				}
+
+				// Each consumer waits for an equal share of the integers.
+				for (size_t i = 0; i < numConsumers; ++i)
+				{
+					consumers.push_back(std::async(std::launch::async, [&]() -> std::vector<int>
+					{
+						std::vector<int> integersPoped;
+						int integer;
+						for (size_t j = 0; j < numProducers * numIntegersPerProducer / numConsumers; ++j)
+						{
+							durableQueue.WaitAndPop(integer);
+							integersPoped.push_back(integer);
+						}
+						return integersPoped;
+					}));
+				}
+
+				for (std::future<void>& producer : producers)
+				{
+					producer.get();
+				}
+
+				// Every integer was popped exactly once.
+				std::vector<int> integersPoped;
+				for (std::future<std::vector<int>>& consumer : consumers)
+				{
+					std::vector<int> consumed = consumer.get();
+					integersPoped.insert(integersPoped.end(), consumed.begin(), consumed.end());
+				}
+
+				std::sort(integersPoped.begin(), integersPoped.end());
+				Assert::AreEqual(numProducers * numIntegersPerProducer, integersPoped.size());
+				for (size_t i = 0; i < integersPoped.size(); ++i)
+				{
+					Assert::AreEqual(static_cast<int>(i), integersPoped[i]);
+				}
+				Assert::IsTrue(durableQueue.Empty());
+			}
+
+			std::filesystem::remove_all(directory);
+		}
 	};
 }
@@ -0,0 +1,306 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+
+// Epoch based memory reclamation for lock free containers.
+//
+// Threads access shared nodes inside critical sections marked by an EpochGuard. Entering a critical section
+// announces the global epoch the thread observed. The global epoch only advances once every thread inside a
+// critical section has observed the current epoch, so once the epoch has advanced twice past the point where a
+// node was retired, no thread can still hold a reference obtained before the node was unlinked.
+//
+// Compared to hazard pointers a reader pays for one announcement per critical section rather than one per node
+// it visits, which makes long read-mostly traversals cheap. The price is that a thread stalled inside a critical
+// section holds back reclamation for everyone.
+class EpochManager
+{
+public:
+	// Upper bound on the number of threads that may use epoch based reclamation concurrently.
+	enum : size_t { MaxThreads = 128 };
+
+	// Hand 'pointer' over for deletion once no thread can still be referencing it.
+	// Must be called after 'pointer' has been unlinked from every shared structure.
+	template<typename T> static void Retire(T* pointer);
+
+	// Hand 'pointer' over to 'deleter' once no thread can still be referencing it.
+	static void Retire(void* pointer, void (*deleter)(void*));
+
+	// Try to advance the global epoch and delete every node retired by the calling thread that has expired.
+	static void Collect();
+
+private:
+	friend class EpochGuard;
+
+	// Announcement of a single thread. Holds the observed epoch shifted left by one with the low bit set while
+	// the thread is inside a critical section, and zero otherwise.
+	struct Record
+	{
+		std::atomic<bool> inUse;
+		std::atomic<uint64_t> announcement;
+	};
+
+	struct RetiredNode
+	{
+		void* pointer;
+		void (*deleter)(void*);
+		uint64_t epoch;
+	};
+
+	// Retired nodes left behind by exited threads, adopted by the next thread to collect.
+	struct OrphanedNodes
+	{
+		std::vector<RetiredNode> nodes;
+		OrphanedNodes* next;
+	};
+
+	// State owned by the calling thread. Released when the thread exits.
+	struct ThreadState
+	{
+		Record* record;
+		size_t nesting;
+		size_t retiredSinceCollect;
+		std::vector<RetiredNode> retiredNodes;
+
+		ThreadState();
+		~ThreadState();
+	};
+
+	// Frees any orphaned nodes on program exit, after every thread has released its state.
+	struct OrphanList
+	{
+		std::atomic<OrphanedNodes*> head;
+
+		OrphanList() : head(nullptr) {}
+		~OrphanList();
+	};
+
+	// Number of retirements between attempts to advance the epoch.
+	enum : size_t { CollectInterval = 64 };
+
+	static Record* GetRecords();
+	static std::atomic<size_t>& GetRecordsInUse();
+	static std::atomic<uint64_t>& GetGlobalEpoch();
+	static OrphanList& GetOrphanList();
+	static ThreadState& GetThreadState();
+
+	static Record* AcquireRecord();
+	static bool TryAdvance();
+	static void DeleteExpiredNodes(std::vector<RetiredNode>& retiredNodes, uint64_t globalEpoch);
+	static void DeleteNodes(std::vector<RetiredNode>& nodes);
+};
+
+// Marks a critical section in which the calling thread may dereference shared nodes.
+// Guards may be nested, only the outermost guard announces and clears the epoch.
+class EpochGuard
+{
+public:
+	EpochGuard();
+	~EpochGuard();
+
+	// Copy semantics.
+	EpochGuard(const EpochGuard& other) = delete;
+	EpochGuard& operator=(const EpochGuard& other) = delete;
+
+	// Move semantics.
+	EpochGuard(EpochGuard&& other) = delete;
+	EpochGuard& operator=(EpochGuard&& other) = delete;
+
+private:
+	EpochManager::ThreadState& m_threadState;
+};
+
+template<typename T>
+inline void EpochManager::Retire(T* pointer)
+{
+	Retire(pointer, [](void* node) -> void { delete static_cast<T*>(node); });
+}
+
+inline void EpochManager::Retire(void* pointer, void (*deleter)(void*))
+{
+	ThreadState& threadState = GetThreadState();
+
+	// The node was unlinked before this load, so any thread that announces this epoch or a later one cannot reach it.
+	threadState.retiredNodes.push_back({ pointer, deleter, GetGlobalEpoch().load() });
+
+	if (++threadState.retiredSinceCollect >= CollectInterval)
+	{
+		Collect();
+	}
+}
+
+inline void EpochManager::Collect()
+{
+	ThreadState& threadState = GetThreadState();
+	threadState.retiredSinceCollect = 0;
+
+	// Adopt the nodes of any exited threads so they are not held forever.
+	OrphanedNodes* orphans = GetOrphanList().head.exchange(nullptr, std::memory_order_acquire);
+	while (orphans != nullptr)
+	{
+		threadState.retiredNodes.insert(threadState.retiredNodes.end(), orphans->nodes.begin(), orphans->nodes.end());
+		OrphanedNodes* orphansToDelete = orphans;
+		orphans = orphans->next;
+		delete orphansToDelete;
+	}
+
+	TryAdvance();
+	DeleteExpiredNodes(threadState.retiredNodes, GetGlobalEpoch().load());
+}
+
+inline EpochManager::Record* EpochManager::GetRecords()
+{
+	static Record records[MaxThreads];
+	return records;
+}
+
+inline std::atomic<size_t>& EpochManager::GetRecordsInUse()
+{
+	// High water mark of records ever claimed, so advancing the epoch never has to look past it.
+	static std::atomic<size_t> recordsInUse(0);
+	return recordsInUse;
+}
+
+inline std::atomic<uint64_t>& EpochManager::GetGlobalEpoch()
+{
+	// Starts at two so that nodes retired in the first epochs never look expired by underflow.
+	static std::atomic<uint64_t> globalEpoch(2);
+	return globalEpoch;
+}
+
+inline EpochManager::OrphanList& EpochManager::GetOrphanList()
+{
+	static OrphanList orphanList;
+	return orphanList;
+}
+
+inline EpochManager::ThreadState& EpochManager::GetThreadState()
+{
+	// Make sure the orphan list outlives every thread state, including the main thread's.
+	GetOrphanList();
+
+	thread_local ThreadState threadState;
+	return threadState;
+}
+
+inline EpochManager::Record* EpochManager::AcquireRecord()
+{
+	Record* records = GetRecords();
+	std::atomic<size_t>& recordsInUse = GetRecordsInUse();
+
+	for (size_t i = 0; i < MaxThreads; ++i)
+	{
+		bool expected = false;
+		if (!records[i].inUse.load(std::memory_order_relaxed) && records[i].inUse.compare_exchange_strong(expected, true))
+		{
+			// Raise the high water mark to include this record.
+			size_t inUse = recordsInUse.load();
+			while (inUse < i + 1 && !recordsInUse.compare_exchange_weak(inUse, i + 1));
+			return &records[i];
+		}
+	}
+
+	throw std::runtime_error("No epoch records available.");
+}
+
+inline bool EpochManager::TryAdvance()
+{
+	std::atomic<uint64_t>& globalEpoch = GetGlobalEpoch();
+	uint64_t epoch = globalEpoch.load();
+
+	// Every thread inside a critical section must have observed the current epoch.
+	Record* records = GetRecords();
+	size_t recordsInUse = GetRecordsInUse().load();
+	for (size_t i = 0; i < recordsInUse; ++i)
+	{
+		uint64_t announcement = records[i].announcement.load();
+		if ((announcement & 1) != 0 && (announcement >> 1) != epoch)
+		{
+			return false;
+		}
+	}
+
+	// Losing this race is fine, another thread advanced the epoch for us.
+	return globalEpoch.compare_exchange_strong(epoch, epoch + 1);
+}
+
+inline void EpochManager::DeleteExpiredNodes(std::vector<RetiredNode>& retiredNodes, uint64_t globalEpoch)
+{
+	// A node retired in epoch E may still be referenced by threads that announced E - 1, which stop the global
+	// epoch from moving past E. So once the global epoch reaches E + 2 no thread can be referencing the node.
+	std::vector<RetiredNode> nodesToDelete;
+	std::vector<RetiredNode> nodesToKeep;
+	for (const RetiredNode& node : retiredNodes)
+	{
+		(node.epoch + 2 <= globalEpoch ? nodesToDelete : nodesToKeep).push_back(node);
+	}
+	retiredNodes.swap(nodesToKeep);
+
+	// Deleters may retire further nodes, so they are run once the retire list is consistent again.
+	DeleteNodes(nodesToDelete);
+}
+
+inline void EpochManager::DeleteNodes(std::vector<RetiredNode>& nodes)
+{
+	for (RetiredNode& node : nodes)
+	{
+		node.deleter(node.pointer);
+	}
+	nodes.clear();
+}
+
+inline EpochManager::ThreadState::ThreadState() : record(AcquireRecord()), nesting(0), retiredSinceCollect(0)
+{
+}
+
+inline EpochManager::ThreadState::~ThreadState()
+{
+	record->announcement.store(0);
+
+	TryAdvance();
+	DeleteExpiredNodes(retiredNodes, GetGlobalEpoch().load());
+
+	// Anything that has not expired yet is handed to whichever thread collects next.
+	if (!retiredNodes.empty())
+	{
+		OrphanedNodes* orphans = new OrphanedNodes{ std::move(retiredNodes), nullptr };
+		std::atomic<OrphanedNodes*>& orphanHead = GetOrphanList().head;
+		orphans->next = orphanHead.load(std::memory_order_relaxed);
+		while (!orphanHead.compare_exchange_weak(orphans->next, orphans, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	record->inUse.store(false);
+}
+
+inline EpochManager::OrphanList::~OrphanList()
+{
+	// No thread is inside a critical section at this point so every orphan can be deleted.
+	OrphanedNodes* orphans = head.load();
+	while (orphans != nullptr)
+	{
+		DeleteNodes(orphans->nodes);
+		OrphanedNodes* orphansToDelete = orphans;
+		orphans = orphans->next;
+		delete orphansToDelete;
+	}
+}
+
+inline EpochGuard::EpochGuard() : m_threadState(EpochManager::GetThreadState())
+{
+	if (m_threadState.nesting++ == 0)
+	{
+		// The announcement must be visible to other threads before any shared node is read.
+		uint64_t epoch = EpochManager::GetGlobalEpoch().load();
+		m_threadState.record->announcement.store((epoch << 1) | 1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+}
+
+inline EpochGuard::~EpochGuard()
+{
+	if (--m_threadState.nesting == 0)
+	{
+		m_threadState.record->announcement.store(0, std::memory_order_release);
+	}
+}
@@ -0,0 +1,105 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "../Epoch-Reclamation/Source/EpochReclamation.h"
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <future>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+// Node that records its own deletion and poisons its value so that use after free is detectable.
+struct TrackedNode
+{
+	static std::atomic<int> liveInstances;
+	std::atomic<int> value;
+
+	TrackedNode(int value) : value(value) { ++liveInstances; }
+	~TrackedNode() { value.store(-1); --liveInstances; }
+};
+std::atomic<int> TrackedNode::liveInstances(0);
+
+namespace Tests
+{
+	TEST_CLASS(Tests)
+	{
+	public:
+		TEST_METHOD(GuardDelaysReclamationTest)
+		{
+			std::promise<void> guardEntered;
+			std::promise<void> releaseGuard;
+			std::shared_future<void> releaseGuardFuture = releaseGuard.get_future().share();
+
+			// Hold a critical section open on another thread.
+			std::thread reader([&]() -> void
+			{
+				EpochGuard guard;
+				guardEntered.set_value();
+				releaseGuardFuture.wait();
+			});
+			guardEntered.get_future().wait();
+
+			int liveBefore = TrackedNode::liveInstances;
+			EpochManager::Retire(new TrackedNode(1));
+
+			// The epoch cannot advance twice while the reader is inside its critical section.
+			for (size_t i = 0; i < 10; ++i)
+			{
+				EpochManager::Collect();
+			}
+			Assert::IsTrue(TrackedNode::liveInstances == liveBefore + 1);
+
+			releaseGuard.set_value();
+			reader.join();
+
+			// With the reader gone the epoch advances and the node is deleted.
+			for (size_t i = 0; i < 10; ++i)
+			{
+				EpochManager::Collect();
+			}
+			Assert::IsTrue(TrackedNode::liveInstances == liveBefore);
+		}
+
+		TEST_METHOD(ConcurrentReadAndRetireTest)
+		{
+			size_t numReaders = 8;
+			size_t numWrites = 10000;
+			std::atomic<TrackedNode*> sharedNode(new TrackedNode(0));
+			std::atomic<bool> done(false);
+			std::vector<std::future<bool>> readers;
+
+			// Readers keep dereferencing whatever node is currently shared.
+			for (size_t i = 0; i < numReaders; ++i)
+			{
+				readers.push_back(std::async(std::launch::async, [&]() -> bool
+				{
+					while (!done.load())
+					{
+						EpochGuard guard;
+						if (sharedNode.load()->value.load() < 0)
+						{
+							return false;
+						}
+					}
+					return true;
+				}));
+			}
+
+			// The writer keeps replacing the shared node and retiring the old one.
+			for (size_t i = 1; i <= numWrites; ++i)
+			{
+				TrackedNode* oldNode = sharedNode.exchange(new TrackedNode(static_cast<int>(i)));
+				EpochManager::Retire(oldNode);
+			}
+			done.store(true);
+
+			// No reader ever saw a deleted node.
+			for (std::future<bool>& reader : readers)
+			{
+				Assert::IsTrue(reader.get());
+			}
+
+			delete sharedNode.load();
+		}
+	};
+}
@@ -0,0 +1,278 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <cstdint>
+#include <type_traits>
+#include <new>
+#include <stdexcept>
+
+// Fixed capacity lock free multi producer multi consumer queue that never allocates after construction (Vyukov).
+//
+// Elements live inline in a power of two array of cells used as a ring. Producers claim the cell at the enqueue
+// position and consumers claim the cell at the dequeue position, each with a single compare and swap on their own
+// counter. Every cell carries a sequence number that says whose turn it is: a cell at position P is free for the
+// producer of P when its sequence is P, holds data for the consumer of P when its sequence is P + 1, and is handed
+// to the producer of the next lap by setting its sequence to P + Capacity. Producers and consumers therefore never
+// touch the same counter, and a claimed cell is owned by one thread until it publishes the new sequence.
+template<typename T>
+class BoundedLockFreeQueue
+{
+public:
+	explicit BoundedLockFreeQueue(size_t capacity);
+	~BoundedLockFreeQueue();
+
+	// Copy semantics.
+	BoundedLockFreeQueue(const BoundedLockFreeQueue<T>& other) = delete;
+	BoundedLockFreeQueue<T>& operator=(const BoundedLockFreeQueue<T>& other) = delete;
+
+	// Move semantics.
+	BoundedLockFreeQueue(BoundedLockFreeQueue<T>&& other) = delete;
+	BoundedLockFreeQueue<T>& operator=(BoundedLockFreeQueue<T>&& other) = delete;
+
+	// Push the data onto the back of the queue. Return false if the queue is full.
+	bool TryPush(const T& data);
+	bool TryPush(T&& data);
+
+	// Construct the data in place at the back of the queue. Return false if the queue is full.
+	template<typename... TArgs> bool TryEmplace(TArgs&&... args);
+
+	// Move the front of the queue into 'result'. Return false if the queue is empty.
+	bool TryPop(T& result);
+
+	// Move the front of the queue out, or return an empty optional if the queue is empty.
+	std::optional<T> TryPop();
+
+	size_t Capacity() const;
+
+private:
+	enum : size_t { CacheLineSize = 64 };
+
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+
+		// A producer whose constructor throws cannot give its claimed cell back, so it publishes the cell
+		// without data and the consumer of that position skips it.
+		bool hasData;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+		T& Data() { return *reinterpret_cast<T*>(&storage); }
+	};
+
+	// Claim the cell at the front of the queue into 'position'. Return nullptr if the queue is empty.
+	Cell* ClaimFront(size_t& position);
+
+	// Hand a consumed cell to the producer of the next lap.
+	void ReleaseFront(Cell* cell, size_t position);
+
+	std::unique_ptr<Cell[]> m_cells;
+	size_t m_mask;
+
+	// The two positions are kept on separate cache lines so that producers and consumers do not contend on the same line.
+	alignas(CacheLineSize) std::atomic<size_t> m_enqueuePosition;
+	alignas(CacheLineSize) std::atomic<size_t> m_dequeuePosition;
+};
+
+template<typename T>
+inline BoundedLockFreeQueue<T>::BoundedLockFreeQueue(size_t capacity) :
+	m_cells(nullptr), m_mask(capacity - 1), m_enqueuePosition(0), m_dequeuePosition(0)
+{
+	// With a single cell a full cell would look free to the producer of the next lap.
+	if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+	{
+		throw std::invalid_argument("BoundedLockFreeQueue capacity must be a power of two of at least two.");
+	}
+
+	m_cells.reset(new Cell[capacity]);
+	for (size_t i = 0; i < capacity; ++i)
+	{
+		m_cells[i].sequence.store(i, std::memory_order_relaxed);
+		m_cells[i].hasData = false;
+	}
+}
+
+template<typename T>
+inline BoundedLockFreeQueue<T>::~BoundedLockFreeQueue()
+{
+	size_t enqueuePosition = m_enqueuePosition.load();
+	for (size_t position = m_dequeuePosition.load(); position != enqueuePosition; ++position)
+	{
+		Cell& cell = m_cells[position & m_mask];
+		if (cell.hasData)
+		{
+			cell.Data().~T();
+		}
+	}
+}
+
+template<typename T>
+inline bool BoundedLockFreeQueue<T>::TryPush(const T& data)
+{
+	return TryEmplace(data);
+}
+
+template<typename T>
+inline bool BoundedLockFreeQueue<T>::TryPush(T&& data)
+{
+	return TryEmplace(std::move(data));
+}
+
+template<typename T>
+template<typename... TArgs>
+inline bool BoundedLockFreeQueue<T>::TryEmplace(TArgs&&... args)
+{
+	size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+	Cell* cell;
+
+	while (true)
+	{
+		cell = &m_cells[position & m_mask];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+		if (difference == 0)
+		{
+			// The cell is free for this position. If the exchange fails position will be updated to the new one.
+			if (m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (difference < 0)
+		{
+			// The cell still holds data from the previous lap, so the queue is full.
+			return false;
+		}
+		else
+		{
+			// Another producer claimed this position.
+			position = m_enqueuePosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	// The cell is owned by this thread until its sequence is published.
+	try
+	{
+		new (&cell->storage) T(std::forward<TArgs>(args)...);
+		cell->hasData = true;
+	}
+	catch (...)
+	{
+		cell->hasData = false;
+		cell->sequence.store(position + 1, std::memory_order_release);
+		throw;
+	}
+
+	cell->sequence.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+template<typename T>
+inline bool BoundedLockFreeQueue<T>::TryPop(T& result)
+{
+	size_t position;
+	Cell* cell = ClaimFront(position);
+	if (cell == nullptr)
+	{
+		return false;
+	}
+
+	// The cell is owned by this thread until it is released.
+	try
+	{
+		result = std::move(cell->Data());
+	}
+	catch (...)
+	{
+		ReleaseFront(cell, position);
+		throw;
+	}
+
+	ReleaseFront(cell, position);
+	return true;
+}
+
+template<typename T>
+inline std::optional<T> BoundedLockFreeQueue<T>::TryPop()
+{
+	size_t position;
+	Cell* cell = ClaimFront(position);
+	if (cell == nullptr)
+	{
+		return std::nullopt;
+	}
+
+	std::optional<T> result;
+	try
+	{
+		result.emplace(std::move(cell->Data()));
+	}
+	catch (...)
+	{
+		ReleaseFront(cell, position);
+		throw;
+	}
+
+	ReleaseFront(cell, position);
+	return result;
+}
+
+template<typename T>
+inline size_t BoundedLockFreeQueue<T>::Capacity() const
+{
+	return m_mask + 1;
+}
+
+template<typename T>
+inline typename BoundedLockFreeQueue<T>::Cell* BoundedLockFreeQueue<T>::ClaimFront(size_t& position)
+{
+	position = m_dequeuePosition.load(std::memory_order_relaxed);
+
+	while (true)
+	{
+		Cell* cell = &m_cells[position & m_mask];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+
+		if (difference == 0)
+		{
+			// The cell holds data for this position. If the exchange fails position will be updated to the new one.
+			if (m_dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				if (cell->hasData)
+				{
+					return cell;
+				}
+
+				// The producer of this position failed to construct its data, skip to the next position.
+				ReleaseFront(cell, position);
+				position = m_dequeuePosition.load(std::memory_order_relaxed);
+			}
+		}
+		else if (difference < 0)
+		{
+			// The producer of this position has not published yet, so the queue is empty.
+			return nullptr;
+		}
+		else
+		{
+			// Another consumer claimed this position.
+			position = m_dequeuePosition.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template<typename T>
+inline void BoundedLockFreeQueue<T>::ReleaseFront(Cell* cell, size_t position)
+{
+	if (cell->hasData)
+	{
+		cell->Data().~T();
+		cell->hasData = false;
+	}
+
+	// Releasing the sequence hands the cell to the producer of the next lap.
+	cell->sequence.store(position + m_mask + 1, std::memory_order_release);
+}
@@ -0,0 +1,259 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <type_traits>
+#include <new>
+#include <algorithm>
+#include <stdexcept>
+
+// Fixed capacity wait free queue for exactly one producer thread and one consumer thread.
+//
+// Elements live inline in a power of two ring. The producer only writes the tail and the consumer only writes the
+// head, so each operation is a bounded number of steps with no compare and swap. The two indices sit on separate
+// cache lines, and each side keeps a private copy of the other side's index that it only refreshes when the ring
+// looks full or empty, so in steady state neither side reads the cache line the other one is writing.
+// The range operations publish a whole batch with a single store.
+template<typename T>
+class SpscRingBuffer
+{
+public:
+	explicit SpscRingBuffer(size_t capacity);
+	~SpscRingBuffer();
+
+	// Copy semantics.
+	SpscRingBuffer(const SpscRingBuffer<T>& other) = delete;
+	SpscRingBuffer<T>& operator=(const SpscRingBuffer<T>& other) = delete;
+
+	// Move semantics.
+	SpscRingBuffer(SpscRingBuffer<T>&& other) = delete;
+	SpscRingBuffer<T>& operator=(SpscRingBuffer<T>&& other) = delete;
+
+	// Producer side. Push the data onto the back of the ring. Return false if the ring is full.
+	bool TryPush(const T& data);
+	bool TryPush(T&& data);
+
+	// Producer side. Construct the data in place at the back of the ring. Return false if the ring is full.
+	template<typename... TArgs> bool TryEmplace(TArgs&&... args);
+
+	// Producer side. Push elements from [first, last) until the ring is full and publish them all at once.
+	// Return the number of elements pushed, the remaining elements are left untouched.
+	template<typename TIterator> size_t TryPushRange(TIterator first, TIterator last);
+
+	// Consumer side. Move the front of the ring into 'result'. Return false if the ring is empty.
+	bool TryPop(T& result);
+
+	// Consumer side. Move the front of the ring out, or return an empty optional if the ring is empty.
+	std::optional<T> TryPop();
+
+	// Consumer side. Move up to 'maxCount' elements into 'output' and release their slots all at once.
+	// Return the number of elements popped.
+	template<typename TOutputIterator> size_t TryPopRange(TOutputIterator output, size_t maxCount);
+
+	size_t Capacity() const;
+
+private:
+	enum : size_t { CacheLineSize = 64 };
+
+	typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+	T& Data(size_t index) { return *reinterpret_cast<T*>(&m_slots[index & m_mask]); }
+
+	// Number of free slots the producer can fill without refreshing its copy of the head.
+	size_t FreeSlots(size_t tail);
+
+	// Number of elements the consumer can read without refreshing its copy of the tail.
+	size_t FilledSlots(size_t head);
+
+	// Read only after construction, shared by both sides.
+	std::unique_ptr<Slot[]> m_slots;
+	size_t m_mask;
+
+	// Written by the producer.
+	alignas(CacheLineSize) std::atomic<size_t> m_tail;
+	size_t m_cachedHead;
+
+	// Written by the consumer.
+	alignas(CacheLineSize) std::atomic<size_t> m_head;
+	size_t m_cachedTail;
+};
+
+template<typename T>
+inline SpscRingBuffer<T>::SpscRingBuffer(size_t capacity) :
+	m_slots(nullptr), m_mask(capacity - 1), m_tail(0), m_cachedHead(0), m_head(0), m_cachedTail(0)
+{
+	if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+	{
+		throw std::invalid_argument("SpscRingBuffer capacity must be a power of two.");
+	}
+
+	m_slots.reset(new Slot[capacity]);
+}
+
+template<typename T>
+inline SpscRingBuffer<T>::~SpscRingBuffer()
+{
+	size_t tail = m_tail.load();
+	for (size_t index = m_head.load(); index != tail; ++index)
+	{
+		Data(index).~T();
+	}
+}
+
+template<typename T>
+inline bool SpscRingBuffer<T>::TryPush(const T& data)
+{
+	return TryEmplace(data);
+}
+
+template<typename T>
+inline bool SpscRingBuffer<T>::TryPush(T&& data)
+{
+	return TryEmplace(std::move(data));
+}
+
+template<typename T>
+template<typename... TArgs>
+inline bool SpscRingBuffer<T>::TryEmplace(TArgs&&... args)
+{
+	size_t tail = m_tail.load(std::memory_order_relaxed);
+	if (FreeSlots(tail) == 0)
+	{
+		return false;
+	}
+
+	new (&m_slots[tail & m_mask]) T(std::forward<TArgs>(args)...);
+
+	// Releasing the tail publishes the data along with it.
+	m_tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+template<typename T>
+template<typename TIterator>
+inline size_t SpscRingBuffer<T>::TryPushRange(TIterator first, TIterator last)
+{
+	// A batch refreshes the copy of the head up front so that it is not cut short by a stale copy.
+	size_t tail = m_tail.load(std::memory_order_relaxed);
+	m_cachedHead = m_head.load(std::memory_order_acquire);
+	size_t freeSlots = FreeSlots(tail);
+	size_t count = 0;
+
+	try
+	{
+		for (; count < freeSlots && first != last; ++first, ++count)
+		{
+			new (&m_slots[(tail + count) & m_mask]) T(*first);
+		}
+	}
+	catch (...)
+	{
+		// Publish what was constructed before the exception.
+		m_tail.store(tail + count, std::memory_order_release);
+		throw;
+	}
+
+	m_tail.store(tail + count, std::memory_order_release);
+	return count;
+}
+
+template<typename T>
+inline bool SpscRingBuffer<T>::TryPop(T& result)
+{
+	size_t head = m_head.load(std::memory_order_relaxed);
+	if (FilledSlots(head) == 0)
+	{
+		return false;
+	}
+
+	// The slot is released even if the data cannot be moved out.
+	struct SlotReleaser
+	{
+		SpscRingBuffer<T>& ring;
+		size_t head;
+		~SlotReleaser() { ring.Data(head).~T(); ring.m_head.store(head + 1, std::memory_order_release); }
+	} slotReleaser{ *this, head };
+
+	result = std::move(Data(head));
+	return true;
+}
+
+template<typename T>
+inline std::optional<T> SpscRingBuffer<T>::TryPop()
+{
+	size_t head = m_head.load(std::memory_order_relaxed);
+	if (FilledSlots(head) == 0)
+	{
+		return std::nullopt;
+	}
+
+	struct SlotReleaser
+	{
+		SpscRingBuffer<T>& ring;
+		size_t head;
+		~SlotReleaser() { ring.Data(head).~T(); ring.m_head.store(head + 1, std::memory_order_release); }
+	} slotReleaser{ *this, head };
+
+	return std::optional<T>(std::move(Data(head)));
+}
+
+template<typename T>
+template<typename TOutputIterator>
+inline size_t SpscRingBuffer<T>::TryPopRange(TOutputIterator output, size_t maxCount)
+{
+	// A batch refreshes the copy of the tail up front so that it is not cut short by a stale copy.
+	size_t head = m_head.load(std::memory_order_relaxed);
+	m_cachedTail = m_tail.load(std::memory_order_acquire);
+	size_t count = std::min(FilledSlots(head), maxCount);
+	size_t popped = 0;
+
+	for (; popped < count; ++popped)
+	{
+		T& data = Data(head + popped);
+		try
+		{
+			*output = std::move(data);
+			++output;
+		}
+		catch (...)
+		{
+			// The element that failed to move out is dropped along with the ones already popped.
+			data.~T();
+			m_head.store(head + popped + 1, std::memory_order_release);
+			throw;
+		}
+		data.~T();
+	}
+
+	m_head.store(head + count, std::memory_order_release);
+	return count;
+}
+
+template<typename T>
+inline size_t SpscRingBuffer<T>::Capacity() const
+{
+	return m_mask + 1;
+}
+
+template<typename T>
+inline size_t SpscRingBuffer<T>::FreeSlots(size_t tail)
+{
+	// Only look at the consumer's cache line when the ring looks full.
+	if (tail - m_cachedHead > m_mask)
+	{
+		m_cachedHead = m_head.load(std::memory_order_acquire);
+	}
+	return m_mask + 1 - (tail - m_cachedHead);
+}
+
+template<typename T>
+inline size_t SpscRingBuffer<T>::FilledSlots(size_t head)
+{
+	// Only look at the producer's cache line when the ring looks empty.
+	if (head == m_cachedTail)
+	{
+		m_cachedTail = m_tail.load(std::memory_order_acquire);
+	}
+	return m_cachedTail - head;
+}
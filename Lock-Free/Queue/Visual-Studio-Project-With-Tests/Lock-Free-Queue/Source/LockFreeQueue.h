@@ -0,0 +1,212 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <type_traits>
+#include <new>
+// The epoch based reclamation component is shared with its own project rather than copied, so both stay in step.
+#include "../../../../Epoch-Reclamation/Visual-Studio-Project-With-Tests/Epoch-Reclamation/Source/EpochReclamation.h"
+
+// Unbounded lock free queue (Michael and Scott).
+//
+// The queue is a singly linked list with a dummy node at the head. Producers link new nodes after the tail with
+// a compare and swap and then swing the tail forward, helping each other when the tail lags behind. Consumers
+// swing the head forward, which turns the first real node into the new dummy and hands its data to the consumer.
+// Unlinked dummies are reclaimed with epoch based reclamation, so a thread that is still reading a node that
+// has just been unlinked never sees it deleted, and a node address cannot be reused under a pending exchange.
+template<typename T>
+class LockFreeQueue
+{
+public:
+	LockFreeQueue();
+	~LockFreeQueue();
+
+	LockFreeQueue(const LockFreeQueue<T>& other) = delete;
+	LockFreeQueue<T>& operator=(const LockFreeQueue<T>& other) = delete;
+
+	LockFreeQueue(LockFreeQueue<T>&& other) = delete;
+	LockFreeQueue<T>& operator=(LockFreeQueue<T>&& other) = delete;
+
+	void Push(const T& value);
+	void Push(T&& value);
+
+	std::shared_ptr<T> TryPop();
+	bool TryPop(T& result);
+
+	bool Empty() const;
+
+private:
+	// The data is stored inline and only constructed for nodes that have not been dequeued yet.
+	struct Node
+	{
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		std::atomic<Node*> next;
+
+		Node() : next(nullptr) {}
+
+		T& Data() { return *reinterpret_cast<T*>(&storage); }
+	};
+
+	enum : size_t { CacheLineSize = 64 };
+
+	// Link a node holding constructed data after the tail.
+	void PushNode(Node* newNode);
+
+	// Unlink the first node holding data and return it, or return nullptr if the queue is empty.
+	// The caller owns the returned node's data and must destroy it before leaving its critical section.
+	Node* PopNode();
+
+private:
+	// Producers and consumers work on opposite ends, so the two ends are kept on separate cache lines.
+	alignas(CacheLineSize) std::atomic<Node*> m_head;
+	alignas(CacheLineSize) std::atomic<Node*> m_tail;
+};
+
+template<typename T>
+inline LockFreeQueue<T>::LockFreeQueue() : m_head(new Node()), m_tail(m_head.load())
+{
+}
+
+template<typename T>
+inline LockFreeQueue<T>::~LockFreeQueue()
+{
+	// The dummy node at the head holds no data.
+	Node* currentNode = m_head.load();
+	Node* nextNode = currentNode->next.load();
+	delete currentNode;
+
+	while (nextNode != nullptr)
+	{
+		currentNode = nextNode;
+		nextNode = currentNode->next.load();
+		currentNode->Data().~T();
+		delete currentNode;
+	}
+}
+
+template<typename T>
+inline void LockFreeQueue<T>::Push(const T& value)
+{
+	std::unique_ptr<Node> newNode(new Node());
+	new (&newNode->storage) T(value);
+	PushNode(newNode.release());
+}
+
+template<typename T>
+inline void LockFreeQueue<T>::Push(T&& value)
+{
+	std::unique_ptr<Node> newNode(new Node());
+	new (&newNode->storage) T(std::move(value));
+	PushNode(newNode.release());
+}
+
+template<typename T>
+inline std::shared_ptr<T> LockFreeQueue<T>::TryPop()
+{
+	EpochGuard guard;
+
+	Node* dequeuedNode = PopNode();
+	if (dequeuedNode == nullptr)
+	{
+		return std::shared_ptr<T>();
+	}
+
+	// Destroy the dequeued data even if it cannot be copied out, otherwise it would leak.
+	struct DataDestroyer { Node* node; ~DataDestroyer() { node->Data().~T(); } } dataDestroyer{ dequeuedNode };
+	return std::make_shared<T>(std::move(dequeuedNode->Data()));
+}
+
+template<typename T>
+inline bool LockFreeQueue<T>::TryPop(T& result)
+{
+	EpochGuard guard;
+
+	Node* dequeuedNode = PopNode();
+	if (dequeuedNode == nullptr)
+	{
+		return false;
+	}
+
+	struct DataDestroyer { Node* node; ~DataDestroyer() { node->Data().~T(); } } dataDestroyer{ dequeuedNode };
+	result = std::move(dequeuedNode->Data());
+	return true;
+}
+
+template<typename T>
+inline bool LockFreeQueue<T>::Empty() const
+{
+	EpochGuard guard;
+	return m_head.load()->next.load() == nullptr;
+}
+
+template<typename T>
+inline void LockFreeQueue<T>::PushNode(Node* newNode)
+{
+	EpochGuard guard;
+
+	while (true)
+	{
+		Node* tail = m_tail.load();
+		Node* next = tail->next.load();
+
+		// The tail moved while its next pointer was being read.
+		if (tail != m_tail.load())
+		{
+			continue;
+		}
+
+		if (next == nullptr)
+		{
+			// Link the new node after the last node, then try to swing the tail to it.
+			// If the tail cannot be swung another thread has already helped.
+			if (tail->next.compare_exchange_weak(next, newNode))
+			{
+				m_tail.compare_exchange_strong(tail, newNode);
+				return;
+			}
+		}
+		else
+		{
+			// The tail is lagging behind the last node, help swing it forward before retrying.
+			m_tail.compare_exchange_strong(tail, next);
+		}
+	}
+}
+
+template<typename T>
+inline typename LockFreeQueue<T>::Node* LockFreeQueue<T>::PopNode()
+{
+	while (true)
+	{
+		Node* head = m_head.load();
+		Node* tail = m_tail.load();
+		Node* next = head->next.load();
+
+		// The head moved while its next pointer was being read.
+		if (head != m_head.load())
+		{
+			continue;
+		}
+
+		// Only the dummy node is present so the queue is empty.
+		if (next == nullptr)
+		{
+			return nullptr;
+		}
+
+		// The tail is lagging behind, swing it forward so that it never points at an unlinked node.
+		if (head == tail)
+		{
+			m_tail.compare_exchange_strong(tail, next);
+			continue;
+		}
+
+		// Swinging the head makes 'next' the new dummy and hands its data to this thread.
+		if (m_head.compare_exchange_weak(head, next))
+		{
+			// Other threads may still be reading the old dummy, it is deleted once they have all moved on.
+			EpochManager::Retire(head);
+			return next;
+		}
+	}
+}
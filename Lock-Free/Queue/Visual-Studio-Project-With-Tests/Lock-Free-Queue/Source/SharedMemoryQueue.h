@@ -0,0 +1,582 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <climits>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#else
+#error "SharedMemoryQueue needs Windows or Linux."
+#endif
+
+// Fixed capacity multi producer multi consumer queue that lives entirely in a named shared memory region, so that
+// processes on the same machine can exchange elements without going through the kernel.
+//
+// The region holds a header followed by a power of two array of cells used as a ring, exactly as in
+// BoundedLockFreeQueue: every cell carries a sequence number that says whether it is free for the producer of a
+// position or holds data for its consumer. Cells are only ever addressed by their position, never by pointer, so
+// every process may map the region at a different address. Every process that opens the queue by the same name
+// sees the same elements.
+//
+// A pop that waits for an element, or a push that waits for a free cell, parks in the kernel after a short spin:
+// on a futex in the shared header on Linux, and on a named semaphore on Windows.
+//
+// Elements are copied byte for byte between processes, so T must be trivially copyable and must not hold pointers.
+template<typename T>
+class SharedMemoryQueue
+{
+	static_assert(std::is_trivially_copyable<T>::value, "SharedMemoryQueue elements must be trivially copyable.");
+
+public:
+	// Open the queue called 'name', creating it with room for 'capacity' elements if it does not exist yet. Every
+	// process must pass the same capacity, which must be a power of two of at least two. On Linux the name must
+	// start with a slash. Throws std::system_error if the region cannot be created or mapped, and std::runtime_error
+	// if the process that created the region does not finish initialising it within InitialisationTimeoutMs, for
+	// example because it died. Remove the name to start over in that case.
+	SharedMemoryQueue(const std::string& name, size_t capacity);
+
+	// Unmaps the region. The queue and its elements live on while another process has it open.
+	~SharedMemoryQueue();
+
+	// Copy semantics.
+	SharedMemoryQueue(const SharedMemoryQueue<T>& other) = delete;
+	SharedMemoryQueue<T>& operator=(const SharedMemoryQueue<T>& other) = delete;
+
+	// Move semantics.
+	SharedMemoryQueue(SharedMemoryQueue<T>&& other) = delete;
+	SharedMemoryQueue<T>& operator=(SharedMemoryQueue<T>&& other) = delete;
+
+	// Remove the name, so that the next process opening it creates a new queue. Processes that have the queue
+	// open keep using the old one. Does nothing on Windows, where the region goes away with its last user.
+	static void Remove(const std::string& name);
+
+	// Push the data onto the back of the queue, waiting while the queue is full.
+	void Push(const T& data);
+
+	// Push the data onto the back of the queue. Return false if the queue is full.
+	bool TryPush(const T& data);
+
+	// Copy the front of the queue into 'result'. Return false if the queue is empty.
+	bool TryPop(T& result);
+
+	// Copy the front of the queue into 'result', waiting while the queue is empty.
+	void WaitAndPop(T& result);
+
+	// Lock free. Exact when no other thread or process is pushing or popping.
+	size_t SizeApprox() const;
+	bool Empty() const;
+
+	size_t Capacity() const;
+
+private:
+	enum : size_t { CacheLineSize = 64 };
+
+	// Number of attempts a waiting operation makes before it parks in the kernel.
+	enum : size_t { SpinCount = 64 };
+
+	// Milliseconds an opening process waits for the creating process to initialise the region.
+	enum : unsigned { InitialisationTimeoutMs = 5000 };
+
+	// Written last by the process that creates the region. Also tells a region of another element size apart.
+	enum : uint64_t { Magic = 0x51554555534D4853ull };
+
+	// Processes waiting for one kind of change to the queue. Every change bumps the sequence when someone waits,
+	// which is also the word a Linux waiter parks on.
+	struct Wakeup
+	{
+		std::atomic<uint32_t> sequence;
+		std::atomic<uint32_t> waiters;
+	};
+
+	enum WakeupKind { NotEmpty = 0, NotFull = 1, NumWakeupKinds = 2 };
+
+	struct Header
+	{
+		std::atomic<uint64_t> magic;
+		uint64_t capacity;
+		uint64_t cellSize;
+
+		// Producers and consumers do not contend on the same cache line.
+		alignas(CacheLineSize) std::atomic<uint64_t> enqueuePosition;
+		alignas(CacheLineSize) std::atomic<uint64_t> dequeuePosition;
+		alignas(CacheLineSize) Wakeup wakeups[NumWakeupKinds];
+	};
+
+	struct Cell
+	{
+		std::atomic<uint64_t> sequence;
+		T data;
+	};
+
+	static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t) && std::atomic<uint64_t>::is_always_lock_free,
+		"SharedMemoryQueue needs address free 64 bit atomics.");
+
+	// Map the region, creating and initialising it if this is the first process to open it.
+	void Open(const std::string& name, size_t regionSize);
+
+	// Throw if the creating process has not initialised the region by 'deadline'.
+	static void CheckInitialisationDeadline(std::chrono::steady_clock::time_point deadline);
+
+	// Release everything Open acquired.
+	void Close();
+
+	// Run 'tryOperation' until it succeeds, parking on the wakeup of 'kind' while it keeps failing.
+	template<typename TOperation>
+	void WaitUntil(WakeupKind kind, TOperation tryOperation);
+
+	// Wake one of the processes waiting on the wakeup of 'kind', if there are any.
+	void Notify(WakeupKind kind);
+
+	// Return true if the queue has an element to pop, or a free cell to push to, for the wakeup of 'kind'. The element
+	// or cell may still be claimed by a thread that has not published it yet.
+	bool HasWork(WakeupKind kind) const;
+
+	// Park until the wakeup of 'kind' is notified. May return spuriously.
+	void Park(WakeupKind kind, uint32_t sequence);
+
+	Cell& CellAt(uint64_t position) { return m_cells[position & m_mask]; }
+
+private:
+	void* m_region;
+	size_t m_regionSize;
+	Header* m_header;
+	Cell* m_cells;
+	uint64_t m_mask;
+
+#if defined(_WIN32)
+	HANDLE m_mapping;
+	HANDLE m_semaphores[NumWakeupKinds];
+#endif
+};
+
+template<typename T>
+inline SharedMemoryQueue<T>::SharedMemoryQueue(const std::string& name, size_t capacity) :
+	m_region(nullptr), m_regionSize(0), m_header(nullptr), m_cells(nullptr), m_mask(capacity - 1)
+{
+	// With a single cell a full cell would look free to the producer of the next lap.
+	if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+	{
+		throw std::invalid_argument("SharedMemoryQueue capacity must be a power of two of at least two.");
+	}
+
+#if defined(_WIN32)
+	m_mapping = nullptr;
+	m_semaphores[NotEmpty] = nullptr;
+	m_semaphores[NotFull] = nullptr;
+#endif
+
+	// The header size is a multiple of the cache line size, so the cells that follow it are aligned.
+	Open(name, sizeof(Header) + capacity * sizeof(Cell));
+}
+
+template<typename T>
+inline SharedMemoryQueue<T>::~SharedMemoryQueue()
+{
+	Close();
+}
+
+template<typename T>
+inline void SharedMemoryQueue<T>::Remove(const std::string& name)
+{
+#if defined(_WIN32)
+	(void)name;
+#else
+	::shm_unlink(name.c_str());
+#endif
+}
+
+template<typename T>
+inline void SharedMemoryQueue<T>::Push(const T& data)
+{
+	WaitUntil(NotFull, [&]() -> bool { return TryPush(data); });
+}
+
+template<typename T>
+inline bool SharedMemoryQueue<T>::TryPush(const T& data)
+{
+	uint64_t position = m_header->enqueuePosition.load(std::memory_order_relaxed);
+	Cell* cell;
+
+	while (true)
+	{
+		cell = &CellAt(position);
+		uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+		int64_t difference = static_cast<int64_t>(sequence - position);
+
+		if (difference == 0)
+		{
+			// The cell is free for this position. If the exchange fails position will be updated to the new one.
+			if (m_header->enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (difference < 0)
+		{
+			// The cell still holds data from the previous lap, so the queue is full.
+			return false;
+		}
+		else
+		{
+			// Another producer claimed this position.
+			position = m_header->enqueuePosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	// The cell is owned by this thread until its sequence is published.
+	cell->data = data;
+	cell->sequence.store(position + 1, std::memory_order_release);
+
+	Notify(NotEmpty);
+	return true;
+}
+
+template<typename T>
+inline bool SharedMemoryQueue<T>::TryPop(T& result)
+{
+	uint64_t position = m_header->dequeuePosition.load(std::memory_order_relaxed);
+	Cell* cell;
+
+	while (true)
+	{
+		cell = &CellAt(position);
+		uint64_t sequence = cell->sequence.load(std::memory_order_acquire);
+		int64_t difference = static_cast<int64_t>(sequence - (position + 1));
+
+		if (difference == 0)
+		{
+			// The cell holds data for this position. If the exchange fails position will be updated to the new one.
+			if (m_header->dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (difference < 0)
+		{
+			// The producer of this position has not published yet, so the queue is empty.
+			return false;
+		}
+		else
+		{
+			// Another consumer claimed this position.
+			position = m_header->dequeuePosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	// The cell is owned by this thread until it is handed to the producer of the next lap.
+	result = cell->data;
+	cell->sequence.store(position + m_mask + 1, std::memory_order_release);
+
+	Notify(NotFull);
+	return true;
+}
+
+template<typename T>
+inline void SharedMemoryQueue<T>::WaitAndPop(T& result)
+{
+	WaitUntil(NotEmpty, [&]() -> bool { return TryPop(result); });
+}
+
+template<typename T>
+inline size_t SharedMemoryQueue<T>::SizeApprox() const
+{
+	// Loading the dequeue position first means the enqueue position read after it can only be larger.
+	uint64_t dequeuePosition = m_header->dequeuePosition.load();
+	return static_cast<size_t>(m_header->enqueuePosition.load() - dequeuePosition);
+}
+
+template<typename T>
+inline bool SharedMemoryQueue<T>::Empty() const
+{
+	return SizeApprox() == 0;
+}
+
+template<typename T>
+inline size_t SharedMemoryQueue<T>::Capacity() const
+{
+	return static_cast<size_t>(m_mask + 1);
+}
+
+template<typename T>
+inline void SharedMemoryQueue<T>::Open(const std::string& name, size_t regionSize)
+{
+	m_regionSize = regionSize;
+	bool created;
+
+	// Bounds the waits for a creating process that may have died half way through.
+	auto initialisationDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(InitialisationTimeoutMs);
+
+#if defined(_WIN32)
+	uint64_t size = regionSize;
+	m_mapping = ::CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), name.c_str());
+	if (m_mapping == nullptr)
+	{
+		throw std::system_error(static_cast<int>(::GetLastError()), std::system_category(), "CreateFileMapping");
+	}
+	created = ::GetLastError() != ERROR_ALREADY_EXISTS;
+
+	m_region = ::MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, regionSize);
+	if (m_region == nullptr)
+	{
+		DWORD error = ::GetLastError();
+		Close();
+		throw std::system_error(static_cast<int>(error), std::system_category(), "MapViewOfFile");
+	}
+
+	// Named semaphores stand in for the futexes, which Windows does not share between processes.
+	const char* suffixes[NumWakeupKinds] = { ".NotEmpty", ".NotFull" };
+	for (int kind = 0; kind < NumWakeupKinds; ++kind)
+	{
+		m_semaphores[kind] = ::CreateSemaphoreA(nullptr, 0, LONG_MAX, (name + suffixes[kind]).c_str());
+		if (m_semaphores[kind] == nullptr)
+		{
+			DWORD error = ::GetLastError();
+			Close();
+			throw std::system_error(static_cast<int>(error), std::system_category(), "CreateSemaphore");
+		}
+	}
+#else
+	int handle = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	created = handle != -1;
+	if (!created && errno == EEXIST)
+	{
+		handle = ::shm_open(name.c_str(), O_RDWR, 0600);
+	}
+	if (handle == -1)
+	{
+		throw std::system_error(errno, std::system_category(), "shm_open");
+	}
+
+	if (created)
+	{
+		// A new region reads as zeros.
+		if (::ftruncate(handle, static_cast<off_t>(regionSize)) == -1)
+		{
+			int error = errno;
+			::close(handle);
+			::shm_unlink(name.c_str());
+			throw std::system_error(error, std::system_category(), "ftruncate");
+		}
+	}
+	else
+	{
+		// The creating process may not have sized the region yet.
+		struct stat status;
+		status.st_size = 0;
+		while (::fstat(handle, &status) == 0 && status.st_size == 0)
+		{
+			try
+			{
+				CheckInitialisationDeadline(initialisationDeadline);
+			}
+			catch (...)
+			{
+				::close(handle);
+				throw;
+			}
+			std::this_thread::yield();
+		}
+		if (static_cast<size_t>(status.st_size) != regionSize)
+		{
+			::close(handle);
+			throw std::runtime_error("SharedMemoryQueue region has a different capacity or element size.");
+		}
+	}
+
+	m_region = ::mmap(nullptr, regionSize, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+	int error = errno;
+	::close(handle);
+	if (m_region == MAP_FAILED)
+	{
+		m_region = nullptr;
+
+		// Nobody else can finish initialising a region this process created.
+		if (created)
+		{
+			::shm_unlink(name.c_str());
+		}
+		throw std::system_error(error, std::system_category(), "mmap");
+	}
+#endif
+
+	m_header = static_cast<Header*>(m_region);
+	m_cells = reinterpret_cast<Cell*>(static_cast<char*>(m_region) + sizeof(Header));
+
+	if (created)
+	{
+		// The region is zero filled, so only the fields that start out non zero need to be written.
+		m_header->capacity = m_mask + 1;
+		m_header->cellSize = sizeof(Cell);
+		for (uint64_t position = 0; position <= m_mask; ++position)
+		{
+			m_cells[position].sequence.store(position, std::memory_order_relaxed);
+		}
+		m_header->magic.store(Magic, std::memory_order_release);
+		return;
+	}
+
+	// Wait for the creating process to finish initialising the region.
+	while (m_header->magic.load(std::memory_order_acquire) != Magic)
+	{
+		try
+		{
+			CheckInitialisationDeadline(initialisationDeadline);
+		}
+		catch (...)
+		{
+			Close();
+			throw;
+		}
+		std::this_thread::yield();
+	}
+	if (m_header->capacity != m_mask + 1 || m_header->cellSize != sizeof(Cell))
+	{
+		Close();
+		throw std::runtime_error("SharedMemoryQueue region has a different capacity or element size.");
+	}
+}
+
+template<typename T>
+inline void SharedMemoryQueue<T>::CheckInitialisationDeadline(std::chrono::steady_clock::time_point deadline)
+{
+	if (std::chrono::steady_clock::now() >= deadline)
+	{
+		throw std::runtime_error("SharedMemoryQueue region was never initialised by the process that created it.");
+	}
+}
+
+template<typename T>
+inline void SharedMemoryQueue<T>::Close()
+{
+#if defined(_WIN32)
+	for (HANDLE& semaphore : m_semaphores)
+	{
+		if (semaphore != nullptr)
+		{
+			::CloseHandle(semaphore);
+			semaphore = nullptr;
+		}
+	}
+	if (m_region != nullptr)
+	{
+		::UnmapViewOfFile(m_region);
+	}
+	if (m_mapping != nullptr)
+	{
+		::CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+#else
+	if (m_region != nullptr)
+	{
+		::munmap(m_region, m_regionSize);
+	}
+#endif
+
+	m_region = nullptr;
+}
+
+template<typename T>
+template<typename TOperation>
+inline void SharedMemoryQueue<T>::WaitUntil(WakeupKind kind, TOperation tryOperation)
+{
+	// The other side often catches up quickly, so try a few times before paying for a system call.
+	for (size_t i = 0; i < SpinCount; ++i)
+	{
+		if (tryOperation())
+		{
+			return;
+		}
+	}
+
+	Wakeup& wakeup = m_header->wakeups[kind];
+	bool woken = false;
+	while (true)
+	{
+		// Register, then try once more. Either the retry sees the change or the other side sees the registration,
+		// and reading the sequence before the retry means a notification after it is never slept through.
+		uint32_t sequence = wakeup.sequence.load();
+		++wakeup.waiters;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (tryOperation())
+		{
+			--wakeup.waiters;
+			return;
+		}
+
+		// A notification is meant for one waiter, but a retry also fails while an earlier position has been claimed
+		// and not published yet, even though later cells are ready. Pass the notification on rather than swallow it,
+		// for as long as there is something to take. This process does not sleep through its own notification, so it
+		// keeps retrying too, yielding to the thread that is still publishing.
+		if (woken && HasWork(kind))
+		{
+			std::this_thread::yield();
+			Notify(kind);
+		}
+
+		Park(kind, sequence);
+		--wakeup.waiters;
+		woken = true;
+	}
+}
+
+template<typename T>
+inline void SharedMemoryQueue<T>::Notify(WakeupKind kind)
+{
+	// Pairs with the fence in WaitUntil.
+	Wakeup& wakeup = m_header->wakeups[kind];
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (wakeup.waiters.load(std::memory_order_relaxed) == 0)
+	{
+		return;
+	}
+
+	++wakeup.sequence;
+
+	// Every push or pop makes room for one waiter only, so waking them all would just send the rest back to sleep.
+	// A waiter that has registered but not parked yet does not sleep through it either: on Linux it sees the new
+	// sequence, and on Windows the semaphore keeps the count.
+#if defined(_WIN32)
+	::ReleaseSemaphore(m_semaphores[kind], 1, nullptr);
+#else
+	// Not a private futex, since the waiters are in other processes.
+	::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&wakeup.sequence), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#endif
+}
+
+template<typename T>
+inline bool SharedMemoryQueue<T>::HasWork(WakeupKind kind) const
+{
+	size_t size = SizeApprox();
+	return (kind == NotEmpty) ? size != 0 : size < Capacity();
+}
+
+template<typename T>
+inline void SharedMemoryQueue<T>::Park(WakeupKind kind, uint32_t sequence)
+{
+#if defined(_WIN32)
+	// A semaphore keeps the count of a release that comes before the wait, so nothing is slept through.
+	(void)sequence;
+	::WaitForSingleObject(m_semaphores[kind], INFINITE);
+#else
+	// Returns right away if the sequence has moved on since it was read.
+	::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_header->wakeups[kind].sequence), FUTEX_WAIT, sequence, nullptr, nullptr, 0);
+#endif
+}
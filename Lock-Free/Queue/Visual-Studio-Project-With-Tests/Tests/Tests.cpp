@@ -0,0 +1,423 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "../Lock-Free-Queue/Source/LockFreeQueue.h"
+#include "../Lock-Free-Queue/Source/BoundedLockFreeQueue.h"
+#include "../Lock-Free-Queue/Source/SpscRingBuffer.h"
+#include "../Lock-Free-Queue/Source/SharedMemoryQueue.h"
+#include <vector>
+#include <thread>
+#include <future>
+#include <stdexcept>
+#include <algorithm>
+#include <iterator>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace Tests
+{
+	TEST_CLASS(Tests)
+	{
+	public:
+		TEST_METHOD(PushThenTryPopMethodsTest)
+		{
+			LockFreeQueue<int> lockFreeQueue;
+			Assert::IsTrue(lockFreeQueue.Empty());
+			Assert::IsTrue(lockFreeQueue.TryPop() == nullptr);
+
+			for (int i = 0; i < 10; ++i)
+			{
+				lockFreeQueue.Push(i);
+			}
+			Assert::IsFalse(lockFreeQueue.Empty());
+
+			// Elements come out in the order they were pushed.
+			for (int i = 0; i < 10; i += 2)
+			{
+				std::shared_ptr<int> integerPtr = lockFreeQueue.TryPop();
+				Assert::IsTrue(integerPtr != nullptr && *integerPtr == i);
+
+				int integer = -1;
+				Assert::IsTrue(lockFreeQueue.TryPop(integer));
+				Assert::AreEqual(i + 1, integer);
+			}
+
+			int integer = -1;
+			Assert::IsFalse(lockFreeQueue.TryPop(integer));
+			Assert::IsTrue(lockFreeQueue.Empty());
+		}
+
+		TEST_METHOD(ContendedPushAndTryPopMethodsTest)
+		{
+			size_t numProducers = 4;
+			size_t numConsumers = 4;
+			int numIntegersPerProducer = 10000;
+
+			LockFreeQueue<int> lockFreeQueue;
+			std::atomic<size_t> producersDone(0);
+			std::vector<std::future<void>> producers;
+			std::vector<std::future<std::vector<int>>> consumers;
+
+			// Each producer pushes its own range of integers in increasing order.
+			for (size_t i = 0; i < numProducers; ++i)
+			{
+				producers.push_back(std::async(std::launch::async, [&, i]() -> void
+				{
+					for (int j = 0; j < numIntegersPerProducer; ++j)
+					{
+						lockFreeQueue.Push(static_cast<int>(i) * numIntegersPerProducer + j);
+					}
+					++producersDone;
+				}));
+			}
+
+			// Consumers pop until every producer is done and the queue is drained.
+			for (size_t i = 0; i < numConsumers; ++i)
+			{
+				consumers.push_back(std::async(std::launch::async, [&]() -> std::vector<int>
+				{
+					std::vector<int> integersPopped;
+					int integer;
+					while (true)
+					{
+						bool allProduced = producersDone.load() == numProducers;
+						if (lockFreeQueue.TryPop(integer))
+						{
+							integersPopped.push_back(integer);
+						}
+						else if (allProduced)
+						{
+							return integersPopped;
+						}
+					}
+				}));
+			}
+
+			for (std::future<void>& producer : producers)
+			{
+				producer.get();
+			}
+
+			std::vector<int> integersPopped;
+			for (std::future<std::vector<int>>& consumer : consumers)
+			{
+				std::vector<int> consumed = consumer.get();
+
+				// A single consumer sees each producer's integers in the order they were pushed.
+				std::vector<int> lastSeen(numProducers, -1);
+				for (int integer : consumed)
+				{
+					Assert::IsTrue(integer > lastSeen[integer / numIntegersPerProducer]);
+					lastSeen[integer / numIntegersPerProducer] = integer;
+				}
+
+				integersPopped.insert(integersPopped.end(), consumed.begin(), consumed.end());
+			}
+
+			// Every integer was popped exactly once.
+			std::sort(integersPopped.begin(), integersPopped.end());
+			Assert::AreEqual(numProducers * numIntegersPerProducer, integersPopped.size());
+			for (size_t i = 0; i < integersPopped.size(); ++i)
+			{
+				Assert::AreEqual(static_cast<int>(i), integersPopped[i]);
+			}
+			Assert::IsTrue(lockFreeQueue.Empty());
+		}
+
+		TEST_METHOD(BoundedPushAndPopMethodsTest)
+		{
+			size_t capacity = 8;
+			BoundedLockFreeQueue<int> boundedQueue(capacity);
+			Assert::AreEqual(capacity, boundedQueue.Capacity());
+			Assert::IsFalse(boundedQueue.TryPop().has_value());
+
+			// Go around the ring several times to exercise wrapping.
+			for (int lap = 0; lap < 3; ++lap)
+			{
+				// Pushes succeed up to the capacity and fail beyond it.
+				for (size_t i = 0; i < capacity; ++i)
+				{
+					Assert::IsTrue(boundedQueue.TryPush(lap * 100 + static_cast<int>(i)));
+				}
+				Assert::IsFalse(boundedQueue.TryPush(-1));
+
+				// Elements come out in the order they were pushed.
+				for (size_t i = 0; i < capacity; ++i)
+				{
+					std::optional<int> integer = boundedQueue.TryPop();
+					Assert::IsTrue(integer.has_value() && *integer == lap * 100 + static_cast<int>(i));
+				}
+
+				int integer = -1;
+				Assert::IsFalse(boundedQueue.TryPop(integer));
+			}
+
+			bool threw = false;
+			try
+			{
+				BoundedLockFreeQueue<int> invalidQueue(6);
+			}
+			catch (const std::invalid_argument&)
+			{
+				threw = true;
+			}
+			Assert::IsTrue(threw);
+		}
+
+		TEST_METHOD(BoundedContendedPushAndPopMethodsTest)
+		{
+			size_t numProducers = 4;
+			size_t numConsumers = 4;
+			int numIntegersPerProducer = 10000;
+
+			// A small ring keeps producers and consumers running into the full and empty cases.
+			BoundedLockFreeQueue<int> boundedQueue(64);
+			std::atomic<size_t> producersDone(0);
+			std::vector<std::future<void>> producers;
+			std::vector<std::future<std::vector<int>>> consumers;
+
+			for (size_t i = 0; i < numProducers; ++i)
+			{
+				producers.push_back(std::async(std::launch::async, [&, i]() -> void
+				{
+					for (int j = 0; j < numIntegersPerProducer; ++j)
+					{
+						while (!boundedQueue.TryPush(static_cast<int>(i) * numIntegersPerProducer + j))
+						{
+							std::this_thread::yield();
+						}
+					}
+					++producersDone;
+				}));
+			}
+
+			for (size_t i = 0; i < numConsumers; ++i)
+			{
+				consumers.push_back(std::async(std::launch::async, [&]() -> std::vector<int>
+				{
+					std::vector<int> integersPopped;
+					int integer;
+					while (true)
+					{
+						bool allProduced = producersDone.load() == numProducers;
+						if (boundedQueue.TryPop(integer))
+						{
+							integersPopped.push_back(integer);
+						}
+						else if (allProduced)
+						{
+							return integersPopped;
+						}
+						else
+						{
+							std::this_thread::yield();
+						}
+					}
+				}));
+			}
+
+			for (std::future<void>& producer : producers)
+			{
+				producer.get();
+			}
+
+			// Every integer was popped exactly once.
+			std::vector<int> integersPopped;
+			for (std::future<std::vector<int>>& consumer : consumers)
+			{
+				std::vector<int> consumed = consumer.get();
+				integersPopped.insert(integersPopped.end(), consumed.begin(), consumed.end());
+			}
+
+			std::sort(integersPopped.begin(), integersPopped.end());
+			Assert::AreEqual(numProducers * numIntegersPerProducer, integersPopped.size());
+			for (size_t i = 0; i < integersPopped.size(); ++i)
+			{
+				Assert::AreEqual(static_cast<int>(i), integersPopped[i]);
+			}
+		}
+
+		TEST_METHOD(SpscPushAndPopMethodsTest)
+		{
+			SpscRingBuffer<int> ringBuffer(4);
+			Assert::AreEqual(static_cast<size_t>(4), ringBuffer.Capacity());
+			Assert::IsFalse(ringBuffer.TryPop().has_value());
+
+			// Single pushes fail once the ring is full.
+			for (int i = 0; i < 3; ++i)
+			{
+				Assert::IsTrue(ringBuffer.TryPush(i));
+			}
+			Assert::IsTrue(ringBuffer.TryEmplace(3));
+			Assert::IsFalse(ringBuffer.TryPush(4));
+
+			int integer = -1;
+			Assert::IsTrue(ringBuffer.TryPop(integer));
+			Assert::AreEqual(0, integer);
+
+			// A range push stops at the capacity and a range pop stops at 'maxCount'.
+			std::vector<int> integersToPush = { 4, 5, 6 };
+			Assert::AreEqual(static_cast<size_t>(1), ringBuffer.TryPushRange(integersToPush.begin(), integersToPush.end()));
+
+			std::vector<int> integersPopped;
+			Assert::AreEqual(static_cast<size_t>(3), ringBuffer.TryPopRange(std::back_inserter(integersPopped), 3));
+			Assert::AreEqual(static_cast<size_t>(2), ringBuffer.TryPushRange(integersToPush.begin() + 1, integersToPush.end()));
+			Assert::AreEqual(static_cast<size_t>(3), ringBuffer.TryPopRange(std::back_inserter(integersPopped), 10));
+
+			// Elements come out in the order they were pushed, across the wrap of the ring.
+			Assert::IsTrue(integersPopped == std::vector<int>({ 1, 2, 3, 4, 5, 6 }));
+			Assert::IsFalse(ringBuffer.TryPop(integer));
+		}
+
+		TEST_METHOD(SpscProducerConsumerTest)
+		{
+			int numIntegers = 100000;
+			SpscRingBuffer<int> ringBuffer(256);
+
+			// The producer alternates between single and batched pushes.
+			std::future<void> producer = std::async(std::launch::async, [&]() -> void
+			{
+				int next = 0;
+				std::vector<int> batch;
+				while (next < numIntegers)
+				{
+					if (next % 2 == 0)
+					{
+						if (!ringBuffer.TryPush(next))
+						{
+							std::this_thread::yield();
+							continue;
+						}
+						++next;
+					}
+					else
+					{
+						batch.clear();
+						for (int i = next; i < std::min(next + 16, numIntegers); ++i)
+						{
+							batch.push_back(i);
+						}
+						next += static_cast<int>(ringBuffer.TryPushRange(batch.begin(), batch.end()));
+					}
+				}
+			});
+
+			// The consumer sees every integer exactly once and in order.
+			int expected = 0;
+			std::vector<int> batch;
+			while (expected < numIntegers)
+			{
+				batch.clear();
+				if (ringBuffer.TryPopRange(std::back_inserter(batch), 32) == 0)
+				{
+					std::this_thread::yield();
+				}
+				for (int integer : batch)
+				{
+					Assert::AreEqual(expected++, integer);
+				}
+			}
+
+			producer.get();
+			Assert::IsFalse(ringBuffer.TryPop().has_value());
+		}
+
+		TEST_METHOD(SharedMemoryPushAndPopMethodsTest)
+		{
+			std::string name = "/SharedMemoryQueueTests.PushAndPop";
+			SharedMemoryQueue<int>::Remove(name);
+
+			// A second queue opened by the same name maps the same region at another address, as another process would.
+			SharedMemoryQueue<int> producerQueue(name, 4);
+			SharedMemoryQueue<int> consumerQueue(name, 4);
+			Assert::AreEqual(static_cast<size_t>(4), consumerQueue.Capacity());
+
+			int integer = -1;
+			Assert::IsFalse(consumerQueue.TryPop(integer));
+			for (int i = 0; i < 4; ++i)
+			{
+				Assert::IsTrue(producerQueue.TryPush(i));
+			}
+			Assert::IsFalse(producerQueue.TryPush(4));
+			Assert::AreEqual(static_cast<size_t>(4), consumerQueue.SizeApprox());
+
+			for (int i = 0; i < 4; ++i)
+			{
+				Assert::IsTrue(consumerQueue.TryPop(integer));
+				Assert::AreEqual(i, integer);
+			}
+			Assert::IsTrue(producerQueue.Empty());
+
+			// Every process has to agree on the layout of the region.
+			Assert::ExpectException<std::exception>([&]() -> void { SharedMemoryQueue<int> mismatchedQueue(name, 2); });
+			Assert::ExpectException<std::invalid_argument>([&]() -> void { SharedMemoryQueue<int> invalidQueue(name, 3); });
+
+			SharedMemoryQueue<int>::Remove(name);
+		}
+
+		TEST_METHOD(SharedMemoryContendedPushAndWaitPopMethodsTest)
+		{
+			std::string name = "/SharedMemoryQueueTests.Contended";
+			SharedMemoryQueue<int>::Remove(name);
+
+			size_t numProducers = 4;
+			size_t numConsumers = 4;
+			int numIntegersPerProducer = 10000;
+
+			// A small ring makes producers wait for free cells as well as consumers wait for elements.
+			SharedMemoryQueue<int> producerQueue(name, 16);
+			SharedMemoryQueue<int> consumerQueue(name, 16);
+			std::vector<std::future<void>> producers;
+			std::vector<std::future<std::vector<int>>> consumers;
+
+			for (size_t i = 0; i < numProducers; ++i)
+			{
+				producers.push_back(std::async(std::launch::async, [&, i]() -> void
+				{
+					for (int j = 0; j < numIntegersPerProducer; ++j)
+					{
+						producerQueue.Push(static_cast<int>(i) * numIntegersPerProducer + j);
+					}
+				}));
+			}
+
+			for (size_t i = 0; i < numConsumers; ++i)
+			{
+				consumers.push_back(std::async(std::launch::async, [&]() -> std::vector<int>
+				{
+					std::vector<int> integersPoped;
+					int integer;
+					for (size_t j = 0; j < numProducers * numIntegersPerProducer / numConsumers; ++j)
+					{
+						consumerQueue.WaitAndPop(integer);
+						integersPoped.push_back(integer);
+					}
+					return integersPoped;
+				}));
+			}
+
+			for (std::future<void>& producer : producers)
+			{
+				producer.get();
+			}
+
+			// Every integer was popped exactly once.
+			std::vector<int> integersPoped;
+			for (std::future<std::vector<int>>& consumer : consumers)
+			{
+				std::vector<int> consumed = consumer.get();
+				integersPoped.insert(integersPoped.end(), consumed.begin(), consumed.end());
+			}
+
+			std::sort(integersPoped.begin(), integersPoped.end());
+			Assert::AreEqual(numProducers * numIntegersPerProducer, integersPoped.size());
+			for (size_t i = 0; i < integersPoped.size(); ++i)
+			{
+				Assert::AreEqual(static_cast<int>(i), integersPoped[i]);
+			}
+			Assert::IsTrue(consumerQueue.Empty());
+
+			SharedMemoryQueue<int>::Remove(name);
+		}
+	};
+}
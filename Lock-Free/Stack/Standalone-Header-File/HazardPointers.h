@@ -0,0 +1,326 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+// Hazard pointer based memory reclamation for lock free containers.
+//
+// A thread that is about to dereference a shared node publishes the node's address in one of its hazard slots.
+// A thread that unlinks a node retires it instead of deleting it. Retired nodes are kept in a per thread list
+// and only deleted by a scan once no hazard slot of any thread points at them. Scans are amortized: a thread
+// only scans once its retire list has grown to a multiple of the number of hazard slots in use.
+class HazardPointerManager
+{
+public:
+	// Upper bounds on the number of threads that may hold hazard pointers concurrently and on the number of
+	// hazard pointers a single thread may hold at the same time.
+	enum : size_t { MaxThreads = 128, SlotsPerThread = 2 };
+
+	// Hand 'pointer' over for deletion once no thread holds a hazard pointer to it.
+	template<typename T> static void Retire(T* pointer);
+
+	// Hand 'pointer' over to 'deleter' once no thread holds a hazard pointer to it.
+	static void Retire(void* pointer, void (*deleter)(void*));
+
+	// Delete every node retired by the calling thread that is no longer protected by a hazard pointer.
+	static void Scan();
+
+private:
+	friend class HazardPointer;
+
+	// Hazard slots owned by a single thread.
+	struct Record
+	{
+		std::atomic<bool> active;
+		std::atomic<void*> slots[SlotsPerThread];
+	};
+
+	struct RetiredNode
+	{
+		void* pointer;
+		void (*deleter)(void*);
+	};
+
+	// Retired nodes left behind by exited threads, adopted by the next thread to scan.
+	struct OrphanedNodes
+	{
+		std::vector<RetiredNode> nodes;
+		OrphanedNodes* next;
+	};
+
+	// State owned by the calling thread. Released when the thread exits.
+	struct ThreadState
+	{
+		Record* record;
+		unsigned int usedSlots;
+		std::vector<RetiredNode> retiredNodes;
+
+		ThreadState();
+		~ThreadState();
+	};
+
+	// Frees any orphaned nodes on program exit, after every thread has released its state.
+	struct OrphanList
+	{
+		std::atomic<OrphanedNodes*> head;
+
+		OrphanList() : head(nullptr) {}
+		~OrphanList();
+	};
+
+	static Record* GetRecords();
+	static std::atomic<size_t>& GetRecordsInUse();
+	static OrphanList& GetOrphanList();
+	static ThreadState& GetThreadState();
+
+	static Record* AcquireRecord();
+	static void ScanRetiredNodes(std::vector<RetiredNode>& retiredNodes);
+	static void DeleteNodes(std::vector<RetiredNode>& nodes);
+};
+
+// A single hazard slot of the calling thread, released on destruction.
+class HazardPointer
+{
+public:
+	HazardPointer();
+	~HazardPointer();
+
+	// Copy semantics.
+	HazardPointer(const HazardPointer& other) = delete;
+	HazardPointer& operator=(const HazardPointer& other) = delete;
+
+	// Move semantics.
+	HazardPointer(HazardPointer&& other) = delete;
+	HazardPointer& operator=(HazardPointer&& other) = delete;
+
+	// Load 'source' and publish the loaded pointer. The returned pointer is safe to dereference until the
+	// hazard pointer is reset, since it was still reachable from 'source' after being published.
+	template<typename T> T* Protect(const std::atomic<T*>& source);
+
+	// Publish 'pointer' without validating it. The caller is responsible for re-checking that it is still reachable.
+	void Set(void* pointer);
+
+	// Stop protecting the current pointer.
+	void Reset();
+
+private:
+	std::atomic<void*>* m_slot;
+	unsigned int m_slotIndex;
+};
+
+template<typename T>
+inline void HazardPointerManager::Retire(T* pointer)
+{
+	Retire(pointer, [](void* node) -> void { delete static_cast<T*>(node); });
+}
+
+inline void HazardPointerManager::Retire(void* pointer, void (*deleter)(void*))
+{
+	ThreadState& threadState = GetThreadState();
+	threadState.retiredNodes.push_back({ pointer, deleter });
+
+	// Scanning costs O(H log H) for H hazard slots, so only scan once enough nodes have been retired to
+	// guarantee that at least half of them can be reclaimed.
+	size_t threshold = 2 * SlotsPerThread * GetRecordsInUse().load(std::memory_order_relaxed) + 16;
+	if (threadState.retiredNodes.size() >= threshold)
+	{
+		Scan();
+	}
+}
+
+inline void HazardPointerManager::Scan()
+{
+	ThreadState& threadState = GetThreadState();
+
+	// Adopt the nodes of any exited threads so they are not held forever.
+	OrphanedNodes* orphans = GetOrphanList().head.exchange(nullptr, std::memory_order_acquire);
+	while (orphans != nullptr)
+	{
+		threadState.retiredNodes.insert(threadState.retiredNodes.end(), orphans->nodes.begin(), orphans->nodes.end());
+		OrphanedNodes* orphansToDelete = orphans;
+		orphans = orphans->next;
+		delete orphansToDelete;
+	}
+
+	ScanRetiredNodes(threadState.retiredNodes);
+}
+
+inline HazardPointerManager::Record* HazardPointerManager::GetRecords()
+{
+	static Record records[MaxThreads];
+	return records;
+}
+
+inline std::atomic<size_t>& HazardPointerManager::GetRecordsInUse()
+{
+	// High water mark of records ever claimed, so scans never have to look past it.
+	static std::atomic<size_t> recordsInUse(0);
+	return recordsInUse;
+}
+
+inline HazardPointerManager::OrphanList& HazardPointerManager::GetOrphanList()
+{
+	static OrphanList orphanList;
+	return orphanList;
+}
+
+inline HazardPointerManager::ThreadState& HazardPointerManager::GetThreadState()
+{
+	// Make sure the orphan list outlives every thread state, including the main thread's.
+	GetOrphanList();
+
+	thread_local ThreadState threadState;
+	return threadState;
+}
+
+inline HazardPointerManager::Record* HazardPointerManager::AcquireRecord()
+{
+	Record* records = GetRecords();
+	std::atomic<size_t>& recordsInUse = GetRecordsInUse();
+
+	for (size_t i = 0; i < MaxThreads; ++i)
+	{
+		bool expected = false;
+		if (!records[i].active.load(std::memory_order_relaxed) && records[i].active.compare_exchange_strong(expected, true))
+		{
+			// Raise the high water mark to include this record.
+			size_t inUse = recordsInUse.load();
+			while (inUse < i + 1 && !recordsInUse.compare_exchange_weak(inUse, i + 1));
+			return &records[i];
+		}
+	}
+
+	throw std::runtime_error("No hazard pointer records available.");
+}
+
+inline void HazardPointerManager::ScanRetiredNodes(std::vector<RetiredNode>& retiredNodes)
+{
+	// Snapshot every published hazard pointer.
+	Record* records = GetRecords();
+	size_t recordsInUse = GetRecordsInUse().load();
+
+	std::vector<void*> hazards;
+	hazards.reserve(recordsInUse * SlotsPerThread);
+	for (size_t i = 0; i < recordsInUse; ++i)
+	{
+		for (size_t j = 0; j < SlotsPerThread; ++j)
+		{
+			void* hazard = records[i].slots[j].load();
+			if (hazard != nullptr)
+			{
+				hazards.push_back(hazard);
+			}
+		}
+	}
+	std::sort(hazards.begin(), hazards.end());
+
+	// Delete every node that is not in the snapshot and keep the rest for a later scan.
+	std::vector<RetiredNode> nodesToDelete;
+	auto isHazardous = [&](const RetiredNode& node) -> bool { return std::binary_search(hazards.begin(), hazards.end(), node.pointer); };
+	auto partitionPoint = std::partition(retiredNodes.begin(), retiredNodes.end(), isHazardous);
+	nodesToDelete.assign(partitionPoint, retiredNodes.end());
+	retiredNodes.erase(partitionPoint, retiredNodes.end());
+
+	// Deleters may retire further nodes, so they are run once the retire list is consistent again.
+	DeleteNodes(nodesToDelete);
+}
+
+inline void HazardPointerManager::DeleteNodes(std::vector<RetiredNode>& nodes)
+{
+	for (RetiredNode& node : nodes)
+	{
+		node.deleter(node.pointer);
+	}
+	nodes.clear();
+}
+
+inline HazardPointerManager::ThreadState::ThreadState() : record(AcquireRecord()), usedSlots(0)
+{
+}
+
+inline HazardPointerManager::ThreadState::~ThreadState()
+{
+	for (size_t i = 0; i < SlotsPerThread; ++i)
+	{
+		record->slots[i].store(nullptr);
+	}
+
+	ScanRetiredNodes(retiredNodes);
+
+	// Anything still protected by another thread is handed to whichever thread scans next.
+	if (!retiredNodes.empty())
+	{
+		OrphanedNodes* orphans = new OrphanedNodes{ std::move(retiredNodes), nullptr };
+		std::atomic<OrphanedNodes*>& orphanHead = GetOrphanList().head;
+		orphans->next = orphanHead.load(std::memory_order_relaxed);
+		while (!orphanHead.compare_exchange_weak(orphans->next, orphans, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	record->active.store(false);
+}
+
+inline HazardPointerManager::OrphanList::~OrphanList()
+{
+	// No thread holds hazard pointers at this point so every orphan can be deleted.
+	OrphanedNodes* orphans = head.load();
+	while (orphans != nullptr)
+	{
+		DeleteNodes(orphans->nodes);
+		OrphanedNodes* orphansToDelete = orphans;
+		orphans = orphans->next;
+		delete orphansToDelete;
+	}
+}
+
+inline HazardPointer::HazardPointer()
+{
+	HazardPointerManager::ThreadState& threadState = HazardPointerManager::GetThreadState();
+
+	// Claim the first free slot of the calling thread's record.
+	for (m_slotIndex = 0; m_slotIndex < HazardPointerManager::SlotsPerThread; ++m_slotIndex)
+	{
+		if ((threadState.usedSlots & (1u << m_slotIndex)) == 0)
+		{
+			threadState.usedSlots |= (1u << m_slotIndex);
+			m_slot = &threadState.record->slots[m_slotIndex];
+			return;
+		}
+	}
+
+	throw std::runtime_error("No hazard pointer slots available on this thread.");
+}
+
+inline HazardPointer::~HazardPointer()
+{
+	m_slot->store(nullptr, std::memory_order_release);
+	HazardPointerManager::GetThreadState().usedSlots &= ~(1u << m_slotIndex);
+}
+
+template<typename T>
+inline T* HazardPointer::Protect(const std::atomic<T*>& source)
+{
+	// Keep publishing until the published pointer is confirmed to still be reachable from 'source'.
+	// Once confirmed any thread that unlinks it afterwards is guaranteed to see the hazard when it scans.
+	T* pointer = source.load();
+	T* confirmedPointer = nullptr;
+	do
+	{
+		confirmedPointer = pointer;
+		m_slot->store(confirmedPointer);
+		pointer = source.load();
+	} while (pointer != confirmedPointer);
+
+	return confirmedPointer;
+}
+
+inline void HazardPointer::Set(void* pointer)
+{
+	m_slot->store(pointer);
+}
+
+inline void HazardPointer::Reset()
+{
+	m_slot->store(nullptr, std::memory_order_release);
+}
@@ -0,0 +1,148 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+// A pointer paired with a tag that is incremented every time the pointer is exchanged.
+// Comparing the tag as well as the pointer means an exchange fails if the pointer was swapped out and back in
+// since it was loaded, even if the same address was reused, which makes compare and swap loops immune to ABA.
+//
+// On x86-64 the pointer and a full 64 bit tag are exchanged together with a double width compare and swap
+// (cmpxchg16b). Elsewhere the tag is packed into the pointer bits that are unused by user space addresses,
+// 16 bits on 64 bit platforms and 32 bits on 32 bit platforms.
+#if (defined(_MSC_VER) && defined(_M_X64)) || (defined(__x86_64__) && defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16))
+#define TAGGED_POINTER_DOUBLE_WIDTH 1
+#else
+#define TAGGED_POINTER_DOUBLE_WIDTH 0
+#endif
+
+template<typename T>
+struct TaggedPointer
+{
+	T* pointer;
+	uint64_t tag;
+};
+
+template<typename T>
+class AtomicTaggedPointer
+{
+public:
+	AtomicTaggedPointer(T* pointer = nullptr);
+	~AtomicTaggedPointer() = default;
+
+	// Copy semantics.
+	AtomicTaggedPointer(const AtomicTaggedPointer<T>& other) = delete;
+	AtomicTaggedPointer<T>& operator=(const AtomicTaggedPointer<T>& other) = delete;
+
+	// Move semantics.
+	AtomicTaggedPointer(AtomicTaggedPointer<T>&& other) = delete;
+	AtomicTaggedPointer<T>& operator=(AtomicTaggedPointer<T>&& other) = delete;
+
+	// Load the current pointer and tag.
+	// With double width exchanges the two halves are read separately and may be torn, which only causes the
+	// following CompareExchange to fail and reload.
+	TaggedPointer<T> Load() const;
+
+	// Replace the pointer with 'desired' and increment the tag if both still match 'expected'.
+	// On failure 'expected' is updated to the current pointer and tag.
+	bool CompareExchange(TaggedPointer<T>& expected, T* desired);
+
+	// True if the pointer and tag are exchanged with a double width compare and swap.
+	static constexpr bool IsDoubleWidth = TAGGED_POINTER_DOUBLE_WIDTH != 0;
+
+private:
+#if TAGGED_POINTER_DOUBLE_WIDTH
+	// The pointer is stored in the low half and the tag in the high half.
+	alignas(16) std::atomic<uint64_t> m_value[2];
+#else
+	enum : uint64_t { PointerBits = (sizeof(void*) == 8) ? 48 : 32, PointerMask = (uint64_t(1) << PointerBits) - 1 };
+
+	static uint64_t Pack(T* pointer, uint64_t tag);
+	static TaggedPointer<T> Unpack(uint64_t value);
+
+	std::atomic<uint64_t> m_value;
+#endif
+};
+
+template<typename T>
+constexpr bool AtomicTaggedPointer<T>::IsDoubleWidth;
+
+#if TAGGED_POINTER_DOUBLE_WIDTH
+
+template<typename T>
+inline AtomicTaggedPointer<T>::AtomicTaggedPointer(T* pointer)
+{
+	m_value[0].store(reinterpret_cast<uint64_t>(pointer), std::memory_order_relaxed);
+	m_value[1].store(0, std::memory_order_relaxed);
+}
+
+template<typename T>
+inline TaggedPointer<T> AtomicTaggedPointer<T>::Load() const
+{
+	// Read the tag first so that a torn read pairs a newer pointer with an older tag and never the other way around.
+	uint64_t tag = m_value[1].load(std::memory_order_acquire);
+	uint64_t pointer = m_value[0].load(std::memory_order_acquire);
+	return { reinterpret_cast<T*>(pointer), tag };
+}
+
+template<typename T>
+inline bool AtomicTaggedPointer<T>::CompareExchange(TaggedPointer<T>& expected, T* desired)
+{
+	uint64_t desiredPointer = reinterpret_cast<uint64_t>(desired);
+	uint64_t desiredTag = expected.tag + 1;
+
+#if defined(_MSC_VER)
+	// The comparand is overwritten with the current value whether or not the exchange succeeds.
+	__int64 comparand[2] = { static_cast<__int64>(reinterpret_cast<uint64_t>(expected.pointer)), static_cast<__int64>(expected.tag) };
+	bool exchanged = _InterlockedCompareExchange128(reinterpret_cast<volatile __int64*>(m_value), static_cast<__int64>(desiredTag), static_cast<__int64>(desiredPointer), comparand) != 0;
+	expected = { reinterpret_cast<T*>(static_cast<uint64_t>(comparand[0])), static_cast<uint64_t>(comparand[1]) };
+#else
+	unsigned __int128 comparand = (static_cast<unsigned __int128>(expected.tag) << 64) | reinterpret_cast<uint64_t>(expected.pointer);
+	unsigned __int128 exchange = (static_cast<unsigned __int128>(desiredTag) << 64) | desiredPointer;
+	unsigned __int128 previous = __sync_val_compare_and_swap(reinterpret_cast<volatile unsigned __int128*>(m_value), comparand, exchange);
+	bool exchanged = previous == comparand;
+	expected = { reinterpret_cast<T*>(static_cast<uint64_t>(previous)), static_cast<uint64_t>(previous >> 64) };
+#endif
+
+	return exchanged;
+}
+
+#else
+
+template<typename T>
+inline AtomicTaggedPointer<T>::AtomicTaggedPointer(T* pointer) : m_value(Pack(pointer, 0))
+{
+}
+
+template<typename T>
+inline TaggedPointer<T> AtomicTaggedPointer<T>::Load() const
+{
+	return Unpack(m_value.load(std::memory_order_acquire));
+}
+
+template<typename T>
+inline bool AtomicTaggedPointer<T>::CompareExchange(TaggedPointer<T>& expected, T* desired)
+{
+	uint64_t expectedValue = Pack(expected.pointer, expected.tag);
+	bool exchanged = m_value.compare_exchange_strong(expectedValue, Pack(desired, expected.tag + 1));
+	expected = Unpack(expectedValue);
+	return exchanged;
+}
+
+template<typename T>
+inline uint64_t AtomicTaggedPointer<T>::Pack(T* pointer, uint64_t tag)
+{
+	// The tag wraps around once it overflows the bits above the pointer.
+	return (tag << PointerBits) | (static_cast<uint64_t>(reinterpret_cast<uintptr_t>(pointer)) & PointerMask);
+}
+
+template<typename T>
+inline TaggedPointer<T> AtomicTaggedPointer<T>::Unpack(uint64_t value)
+{
+	return { reinterpret_cast<T*>(static_cast<uintptr_t>(value & PointerMask)), value >> PointerBits };
+}
+
+#endif
@@ -0,0 +1,172 @@
+#include "LockFreeStack.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <thread>
+#include <vector>
+
+// Measures LockFreeStack push and pop throughput against a stack whose head is a plain std::atomic<Node*>
+// updated with a sequentially consistent compare and swap loop, the representation LockFreeStack used before
+// its head was tagged. Both stacks reclaim popped nodes with hazard pointers, store the data inline and recycle
+// nodes through a per thread cache, so the comparison is between the head representations rather than the cost
+// of allocation. LockFreeStack also falls back to its elimination array when a head exchange fails, which the
+// baseline does not have.
+template<typename T>
+class PointerHeadStack
+{
+public:
+	PointerHeadStack() : m_head(nullptr) {}
+
+	~PointerHeadStack()
+	{
+		while (std::shared_ptr<T> dataPtr = Pop());
+	}
+
+	void Push(const T& data)
+	{
+		Node* newNode = AllocateNode();
+		new (&newNode->storage) T(data);
+		newNode->next = m_head.load();
+		while (!m_head.compare_exchange_weak(newNode->next, newNode, std::memory_order_seq_cst, std::memory_order_relaxed));
+	}
+
+	std::shared_ptr<T> Pop()
+	{
+		HazardPointer hazardPointer;
+		Node* nodeToPop = hazardPointer.Protect(m_head);
+		while (nodeToPop != nullptr && !m_head.compare_exchange_strong(nodeToPop, nodeToPop->next))
+		{
+			nodeToPop = hazardPointer.Protect(m_head);
+		}
+		hazardPointer.Reset();
+
+		std::shared_ptr<T> dataPtr(nullptr);
+		if (nodeToPop != nullptr)
+		{
+			dataPtr = std::make_shared<T>(std::move(nodeToPop->Data()));
+			nodeToPop->Data().~T();
+			HazardPointerManager::Retire(nodeToPop, &ReleaseRetiredNode);
+		}
+		return dataPtr;
+	}
+
+private:
+	struct Node
+	{
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		Node* next;
+
+		Node() : next(nullptr) {}
+
+		T& Data() { return *reinterpret_cast<T*>(&storage); }
+	};
+
+	enum : size_t { NodeCacheSize = 64 };
+
+	// Trivially destructible, so retired nodes can still be released while the thread's locals are being destroyed.
+	struct NodeCache
+	{
+		Node* nodes[NodeCacheSize];
+		size_t count;
+		bool closed;
+	};
+
+	// Delete the calling thread's cached nodes when the thread exits.
+	struct NodeCacheCloser
+	{
+		~NodeCacheCloser()
+		{
+			NodeCache& nodeCache = GetNodeCache();
+			while (nodeCache.count > 0)
+			{
+				delete nodeCache.nodes[--nodeCache.count];
+			}
+			nodeCache.closed = true;
+		}
+	};
+
+	static NodeCache& GetNodeCache()
+	{
+		thread_local NodeCache nodeCache = {};
+		thread_local NodeCacheCloser nodeCacheCloser;
+		return nodeCache;
+	}
+
+	static Node* AllocateNode()
+	{
+		NodeCache& nodeCache = GetNodeCache();
+		return (nodeCache.count > 0) ? nodeCache.nodes[--nodeCache.count] : new Node();
+	}
+
+	static void ReleaseRetiredNode(void* pointer)
+	{
+		Node* node = static_cast<Node*>(pointer);
+		NodeCache& nodeCache = GetNodeCache();
+		if (nodeCache.closed || nodeCache.count == NodeCacheSize)
+		{
+			delete node;
+			return;
+		}
+		nodeCache.nodes[nodeCache.count++] = node;
+	}
+
+	std::atomic<Node*> m_head;
+};
+
+// Run 'numThreads' threads that each push and pop 'numOperations' integers and return millions of operations per second.
+template<typename TStack>
+double MeasureThroughput(size_t numThreads, size_t numOperations)
+{
+	TStack stack;
+	std::atomic<bool> start(false);
+	std::vector<std::thread> threads;
+
+	for (size_t i = 0; i < numThreads; ++i)
+	{
+		threads.push_back(std::thread([&]() -> void
+		{
+			while (!start.load());
+			for (size_t j = 0; j < numOperations; ++j)
+			{
+				stack.Push(static_cast<int>(j));
+				stack.Pop();
+			}
+		}));
+	}
+
+	auto startTime = std::chrono::steady_clock::now();
+	start.store(true);
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+
+	return (2.0 * numThreads * numOperations) / elapsed.count() / 1e6;
+}
+
+int main()
+{
+	const size_t numOperations = 200000;
+	size_t maxThreads = std::thread::hardware_concurrency();
+	if (maxThreads == 0)
+	{
+		maxThreads = 4;
+	}
+
+	std::printf("Tagged head uses %s compare and swap.\n", AtomicTaggedPointer<int>::IsDoubleWidth ? "a double width" : "a packed single width");
+	std::printf("%8s %20s %20s\n", "Threads", "Tagged (Mops/s)", "Untagged (Mops/s)");
+
+	for (size_t numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+	{
+		double tagged = MeasureThroughput<LockFreeStack<int>>(numThreads, numOperations);
+		double untagged = MeasureThroughput<PointerHeadStack<int>>(numThreads, numOperations);
+		std::printf("%8zu %20.2f %20.2f\n", numThreads, tagged, untagged);
+	}
+
+	return 0;
+}
@@ -0,0 +1,233 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <cstdint>
+#include <type_traits>
+#include <new>
+#include <stdexcept>
+
+// Fixed capacity lock free stack that never allocates after construction.
+//
+// Elements live in a contiguous array of slots allocated up front. Slots are linked by index into two Treiber
+// stacks: the stack of elements and a free list of empty slots. Each list head packs the index of its top slot
+// with a 32 bit tag that is incremented on every exchange, so a head that was popped and pushed back since it
+// was loaded is never mistaken for the current one. Since slots are never freed, reading the next index of a
+// slot that has just been popped by another thread is always safe.
+template<typename T>
+class BoundedLockFreeStack
+{
+public:
+	explicit BoundedLockFreeStack(size_t capacity);
+	~BoundedLockFreeStack();
+
+	// Copy semantics.
+	BoundedLockFreeStack(const BoundedLockFreeStack<T>& other) = delete;
+	BoundedLockFreeStack<T>& operator=(const BoundedLockFreeStack<T>& other) = delete;
+
+	// Move semantics.
+	BoundedLockFreeStack(BoundedLockFreeStack<T>&& other) = delete;
+	BoundedLockFreeStack<T>& operator=(BoundedLockFreeStack<T>&& other) = delete;
+
+	// Push the data onto the stack. Return false if the stack is full.
+	bool TryPush(const T& data);
+	bool TryPush(T&& data);
+
+	// Construct the data in place on top of the stack. Return false if the stack is full.
+	template<typename... TArgs> bool TryEmplace(TArgs&&... args);
+
+	// Move the top of the stack into 'result'. Return false if the stack is empty.
+	bool TryPop(T& result);
+
+	// Move the top of the stack out, or return an empty optional if the stack is empty.
+	std::optional<T> TryPop();
+
+	size_t Capacity() const;
+
+private:
+	enum : uint32_t { NullIndex = 0xFFFFFFFF };
+	enum : size_t { CacheLineSize = 64 };
+
+	struct Slot
+	{
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		std::atomic<uint32_t> next;
+
+		T& Data() { return *reinterpret_cast<T*>(&storage); }
+	};
+
+	// Index of the top slot in the low half and the tag in the high half.
+	static uint64_t Pack(uint32_t index, uint32_t tag) { return (static_cast<uint64_t>(tag) << 32) | index; }
+	static uint32_t IndexOf(uint64_t head) { return static_cast<uint32_t>(head); }
+	static uint32_t TagOf(uint64_t head) { return static_cast<uint32_t>(head >> 32); }
+
+	// Unlink the top slot of 'list' into 'index'. Return false if the list is empty.
+	bool PopIndex(std::atomic<uint64_t>& list, uint32_t& index);
+
+	// Link the slot at 'index' onto the top of 'list'.
+	void PushIndex(std::atomic<uint64_t>& list, uint32_t index);
+
+	std::unique_ptr<Slot[]> m_slots;
+	size_t m_capacity;
+
+	// The two heads are kept on separate cache lines so that pushes and pops do not contend on the same line.
+	alignas(CacheLineSize) std::atomic<uint64_t> m_top;
+	alignas(CacheLineSize) std::atomic<uint64_t> m_free;
+};
+
+template<typename T>
+inline BoundedLockFreeStack<T>::BoundedLockFreeStack(size_t capacity) :
+	m_slots(nullptr), m_capacity(capacity), m_top(Pack(NullIndex, 0)), m_free(Pack(NullIndex, 0))
+{
+	if (capacity >= NullIndex)
+	{
+		throw std::invalid_argument("BoundedLockFreeStack capacity must fit in a 32 bit index.");
+	}
+
+	// Every slot starts out on the free list.
+	m_slots.reset(new Slot[capacity]);
+	for (size_t i = 0; i < capacity; ++i)
+	{
+		m_slots[i].next.store((i + 1 < capacity) ? static_cast<uint32_t>(i + 1) : static_cast<uint32_t>(NullIndex), std::memory_order_relaxed);
+	}
+	m_free.store(Pack(capacity > 0 ? 0 : static_cast<uint32_t>(NullIndex), 0));
+}
+
+template<typename T>
+inline BoundedLockFreeStack<T>::~BoundedLockFreeStack()
+{
+	uint32_t index = IndexOf(m_top.load());
+	while (index != NullIndex)
+	{
+		m_slots[index].Data().~T();
+		index = m_slots[index].next.load(std::memory_order_relaxed);
+	}
+}
+
+template<typename T>
+inline bool BoundedLockFreeStack<T>::TryPush(const T& data)
+{
+	return TryEmplace(data);
+}
+
+template<typename T>
+inline bool BoundedLockFreeStack<T>::TryPush(T&& data)
+{
+	return TryEmplace(std::move(data));
+}
+
+template<typename T>
+template<typename... TArgs>
+inline bool BoundedLockFreeStack<T>::TryEmplace(TArgs&&... args)
+{
+	uint32_t index;
+	if (!PopIndex(m_free, index))
+	{
+		return false;
+	}
+
+	// The slot is owned by this thread until it is linked onto the stack.
+	try
+	{
+		new (&m_slots[index].storage) T(std::forward<TArgs>(args)...);
+	}
+	catch (...)
+	{
+		PushIndex(m_free, index);
+		throw;
+	}
+
+	PushIndex(m_top, index);
+	return true;
+}
+
+template<typename T>
+inline bool BoundedLockFreeStack<T>::TryPop(T& result)
+{
+	uint32_t index;
+	if (!PopIndex(m_top, index))
+	{
+		return false;
+	}
+
+	// The slot is owned by this thread until it is linked back onto the free list.
+	try
+	{
+		result = std::move(m_slots[index].Data());
+	}
+	catch (...)
+	{
+		m_slots[index].Data().~T();
+		PushIndex(m_free, index);
+		throw;
+	}
+
+	m_slots[index].Data().~T();
+	PushIndex(m_free, index);
+	return true;
+}
+
+template<typename T>
+inline std::optional<T> BoundedLockFreeStack<T>::TryPop()
+{
+	uint32_t index;
+	if (!PopIndex(m_top, index))
+	{
+		return std::nullopt;
+	}
+
+	std::optional<T> result;
+	try
+	{
+		result.emplace(std::move(m_slots[index].Data()));
+	}
+	catch (...)
+	{
+		m_slots[index].Data().~T();
+		PushIndex(m_free, index);
+		throw;
+	}
+
+	m_slots[index].Data().~T();
+	PushIndex(m_free, index);
+	return result;
+}
+
+template<typename T>
+inline size_t BoundedLockFreeStack<T>::Capacity() const
+{
+	return m_capacity;
+}
+
+template<typename T>
+inline bool BoundedLockFreeStack<T>::PopIndex(std::atomic<uint64_t>& list, uint32_t& index)
+{
+	uint64_t oldHead = list.load(std::memory_order_acquire);
+
+	// If the exchange fails oldHead will be updated to the new head.
+	// A stale next index is harmless, because the tag of a stale head no longer matches.
+	while (IndexOf(oldHead) != NullIndex)
+	{
+		uint32_t next = m_slots[IndexOf(oldHead)].next.load(std::memory_order_relaxed);
+		if (list.compare_exchange_weak(oldHead, Pack(next, TagOf(oldHead) + 1), std::memory_order_acquire, std::memory_order_acquire))
+		{
+			index = IndexOf(oldHead);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+template<typename T>
+inline void BoundedLockFreeStack<T>::PushIndex(std::atomic<uint64_t>& list, uint32_t index)
+{
+	uint64_t oldHead = list.load(std::memory_order_relaxed);
+
+	// Releasing the head publishes the slot's data along with it.
+	do
+	{
+		m_slots[index].next.store(IndexOf(oldHead), std::memory_order_relaxed);
+	} while (!list.compare_exchange_weak(oldHead, Pack(index, TagOf(oldHead) + 1), std::memory_order_release, std::memory_order_relaxed));
+}
@@ -1,6 +1,21 @@
 #pragma once
 #include <atomic>
 #include <memory>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <type_traits>
+#include <new>
+#include <optional>
+#include <utility>
+#include <iterator>
+#include <cstddef>
+#include "HazardPointers.h"
+#include "TaggedPointer.h"
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#endif
 
 template<typename T>
 class LockFreeStack
@@ -18,18 +33,210 @@ public:
 	LockFreeStack<T>& operator=(LockFreeStack<T>&& other) = delete;
 
 	void Push(const T& data);
+	void Push(T&& data);
+
+	// Construct the data in place on top of the stack.
+	template<typename... TArgs> void Emplace(TArgs&&... args);
+
 	std::shared_ptr<T> Pop();
 
+	// Move the top of the stack into 'result'. Return false if the stack is empty.
+	bool TryPop(T& result);
+
+	// Move the top of the stack out, or return an empty optional if the stack is empty.
+	std::optional<T> TryPop();
+
+	// Push every element of [first, last) with a single exchange of the head. The last element ends up on top.
+	template<typename TIterator> void PushRange(TIterator first, TIterator last);
+
+	// Detach every node on the stack with a single exchange of the head.
+	class Chain;
+	Chain PopAll();
+
+	// Number of pushes and pops that met in the elimination array instead of on the head. For tests and tuning.
+	size_t NumEliminatedPairs() const;
+
 private:
+	// The data is stored inline. It is constructed in place when the node is pushed and destroyed as soon as it
+	// is popped, so that the node's storage can be recycled without another trip to the heap.
 	struct Node
 	{
-		std::shared_ptr<T> data;
-		Node* next;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		std::atomic<Node*> next;
+
+		Node() : next(nullptr) {}
+
+		T& Data() { return *reinterpret_cast<T*>(&storage); }
+	};
+
+	// Recycles node storage between every LockFreeStack<T>.
+	// Each thread keeps a small cache of free nodes. A full cache spills half of its nodes onto a shared free
+	// list and an empty cache takes from the shared free list before falling back to the heap.
+	// Nodes on the shared free list are only deleted on exit, so a thread racing to pop from the free list can
+	// always read a node's next pointer, and the free list head is tagged to protect it against ABA.
+	class NodePool
+	{
+	public:
+		static Node* Allocate();
+		static void Release(Node* node);
+
+		// Adapter for releasing nodes retired with the hazard pointer manager.
+		static void ReleaseRetired(void* node);
+
+	private:
+		enum : size_t { ThreadCacheSize = 64 };
+
+		// Both are trivially destructible so they can still be used while thread and static locals are being destroyed.
+		struct ThreadCache
+		{
+			Node* nodes[ThreadCacheSize];
+			size_t count;
+			bool flushed;
+		};
+
+		struct SharedFreeList
+		{
+			AtomicTaggedPointer<Node> head;
+			std::atomic<bool> releaseToHeap;
 
-		Node(const T& data) : data(std::make_shared<T>(data)), next(nullptr) {}
+			SharedFreeList() : head(nullptr), releaseToHeap(false) {}
+		};
+
+		// Move the calling thread's cache to the shared free list when the thread exits.
+		struct ThreadCacheFlusher
+		{
+			~ThreadCacheFlusher();
+		};
+
+		// Delete the nodes on the shared free list on exit.
+		struct SharedFreeListCleanup
+		{
+			~SharedFreeListCleanup();
+		};
+
+		static ThreadCache& GetThreadCache();
+		static SharedFreeList& GetSharedFreeList();
+
+		static void PushShared(Node* first, Node* last);
+		static Node* PopShared();
 	};
 
-	std::atomic<Node*> m_head;
+	// Elimination backoff array (Hendler, Shavit and Yerushalmi).
+	// A push and a pop that collide on the head can cancel each other out without touching the head: the push
+	// parks its node in a random slot for a short while and a pop that finds it there takes it directly.
+	// The pair is linearized as the push immediately followed by the pop.
+	class EliminationArray
+	{
+	public:
+		EliminationArray();
+
+		// Offer 'node' to a concurrent Pop. Return true if a Pop took it.
+		bool TryPush(Node* node);
+
+		// Take a node offered by a concurrent Push, or return nullptr if no node is on offer in the probed slot.
+		Node* TryPop();
+
+		size_t NumExchanges() const { return m_numExchanges.load(std::memory_order_relaxed); }
+
+	private:
+		// Number of times a push checks whether its offer was taken before withdrawing it.
+		enum : size_t { SpinCount = 128, CacheLineSize = 64 };
+
+		// Each slot sits on its own cache line so that collisions in one slot do not slow down the others.
+		struct Slot
+		{
+			std::atomic<Node*> node;
+			char padding[CacheLineSize - sizeof(std::atomic<Node*>)];
+
+			Slot() : node(nullptr) {}
+		};
+
+		// Left in a slot by the Pop that took its node, until the Push that offered the node clears it.
+		// The slot cannot be reused before then, so a Push never mistakes another Push's node for its own.
+		static Node* TakenMarker() { return reinterpret_cast<Node*>(uintptr_t(1)); }
+
+		Slot& GetRandomSlot();
+
+		// Tell the processor this is a spin wait, so that it does not starve a sibling hyperthread running the Pop
+		// the Push is waiting for.
+		static void Pause();
+
+		std::unique_ptr<Slot[]> m_slots;
+		size_t m_numSlots;
+
+		// Only advanced by a Pop that took a node, so it stays off the fast path.
+		std::atomic<size_t> m_numExchanges;
+	};
+
+	// The head is tagged so an exchange fails if the head node was popped and pushed back since it was loaded.
+	AtomicTaggedPointer<Node> m_head;
+
+	EliminationArray m_eliminationArray;
+
+	// Link the chain of nodes from 'first' down to 'last' onto the top of the stack.
+	void PushChain(Node* first, Node* last);
+
+	// Unlink the top node, or return nullptr if the stack is empty.
+	// The caller owns the popped node's data and must hand the node to RetireNode once it has been moved out.
+	Node* PopNode();
+
+	// Destroy the data of a popped node and recycle it once no other thread can be reading it.
+	static void RetireNode(Node* node);
+};
+
+// Nodes detached from a LockFreeStack by PopAll, iterated from the former top of the stack down to its bottom.
+// The chain owns the data, which is destroyed along with the chain.
+template<typename T>
+class LockFreeStack<T>::Chain
+{
+public:
+	class Iterator
+	{
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = T*;
+		using reference = T&;
+
+		explicit Iterator(Node* node) : m_node(node) {}
+
+		T& operator*() const { return m_node->Data(); }
+		T* operator->() const { return &m_node->Data(); }
+
+		Iterator& operator++() { m_node = m_node->next.load(std::memory_order_relaxed); return *this; }
+		Iterator operator++(int) { Iterator previous(*this); ++(*this); return previous; }
+
+		bool operator==(const Iterator& other) const { return m_node == other.m_node; }
+		bool operator!=(const Iterator& other) const { return m_node != other.m_node; }
+
+	private:
+		Node* m_node;
+	};
+
+	~Chain();
+
+	// Copy semantics.
+	Chain(const Chain& other) = delete;
+	Chain& operator=(const Chain& other) = delete;
+
+	// Move semantics.
+	Chain(Chain&& other);
+	Chain& operator=(Chain&& other);
+
+	Iterator begin() const { return Iterator(m_head); }
+	Iterator end() const { return Iterator(nullptr); }
+
+	bool Empty() const { return m_head == nullptr; }
+
+private:
+	friend class LockFreeStack<T>;
+
+	explicit Chain(Node* head) : m_head(head) {}
+
+	void Clear();
+
+	Node* m_head;
 };
 
 template<typename T>
@@ -40,38 +247,500 @@ inline LockFreeStack<T>::LockFreeStack() : m_head(nullptr)
 template<typename T>
 inline LockFreeStack<T>::~LockFreeStack()
 {
-	while (m_head != nullptr)
+	Node* currentNode = m_head.Load().pointer;
+	while (currentNode != nullptr)
 	{
-		Node* nodeToDelete = m_head;
-		m_head.store(m_head.load()->next);
-		delete nodeToDelete;
+		Node* nodeToDelete = currentNode;
+		currentNode = currentNode->next.load(std::memory_order_relaxed);
+		nodeToDelete->Data().~T();
+		NodePool::Release(nodeToDelete);
 	}
 }
 
 template<typename T>
 inline void LockFreeStack<T>::Push(const T& data)
 {
-	Node* newNode = new Node(data);
-	newNode->next = m_head;
+	Emplace(data);
+}
+
+template<typename T>
+inline void LockFreeStack<T>::Push(T&& data)
+{
+	Emplace(std::move(data));
+}
 
-	// If the exchange fails newNode->next pointer will be updated to the new head.
-	// If the exchange succeeds the head will point to the new node.
-	while (!m_head.compare_exchange_weak(newNode->next, newNode, std::memory_order_seq_cst, std::memory_order_relaxed));
+template<typename T>
+template<typename... TArgs>
+inline void LockFreeStack<T>::Emplace(TArgs&&... args)
+{
+	Node* newNode = NodePool::Allocate();
+	try
+	{
+		new (&newNode->storage) T(std::forward<TArgs>(args)...);
+	}
+	catch (...)
+	{
+		NodePool::Release(newNode);
+		throw;
+	}
+
+	PushChain(newNode, newNode);
 }
 
 template<typename T>
 inline std::shared_ptr<T> LockFreeStack<T>::Pop()
 {
+	Node* nodeToPop = PopNode();
+	if (nodeToPop == nullptr)
+	{
+		return std::shared_ptr<T>();
+	}
+
+	std::shared_ptr<T> dataPtr;
+	try
+	{
+		dataPtr = std::make_shared<T>(std::move(nodeToPop->Data()));
+	}
+	catch (...)
+	{
+		RetireNode(nodeToPop);
+		throw;
+	}
+
+	RetireNode(nodeToPop);
+	return dataPtr;
+}
+
+template<typename T>
+inline bool LockFreeStack<T>::TryPop(T& result)
+{
+	Node* nodeToPop = PopNode();
+	if (nodeToPop == nullptr)
+	{
+		return false;
+	}
+
+	try
+	{
+		result = std::move(nodeToPop->Data());
+	}
+	catch (...)
+	{
+		RetireNode(nodeToPop);
+		throw;
+	}
+
+	RetireNode(nodeToPop);
+	return true;
+}
+
+template<typename T>
+inline std::optional<T> LockFreeStack<T>::TryPop()
+{
+	Node* nodeToPop = PopNode();
+	if (nodeToPop == nullptr)
+	{
+		return std::nullopt;
+	}
+
+	std::optional<T> result;
+	try
+	{
+		result.emplace(std::move(nodeToPop->Data()));
+	}
+	catch (...)
+	{
+		RetireNode(nodeToPop);
+		throw;
+	}
+
+	RetireNode(nodeToPop);
+	return result;
+}
+
+template<typename T>
+template<typename TIterator>
+inline void LockFreeStack<T>::PushRange(TIterator first, TIterator last)
+{
+	Node* top = nullptr;
+	Node* bottom = nullptr;
+
+	// Build a private chain with the last element on top, so the stack ends up as if each element had been pushed in turn.
+	try
+	{
+		for (; first != last; ++first)
+		{
+			Node* newNode = NodePool::Allocate();
+			try
+			{
+				new (&newNode->storage) T(*first);
+			}
+			catch (...)
+			{
+				NodePool::Release(newNode);
+				throw;
+			}
+
+			newNode->next.store(top, std::memory_order_relaxed);
+			top = newNode;
+			if (bottom == nullptr)
+			{
+				bottom = newNode;
+			}
+		}
+	}
+	catch (...)
+	{
+		// Nothing has been published yet, so the chain can be torn down directly.
+		while (top != nullptr)
+		{
+			Node* nodeToDelete = top;
+			top = top->next.load(std::memory_order_relaxed);
+			nodeToDelete->Data().~T();
+			NodePool::Release(nodeToDelete);
+		}
+		throw;
+	}
+
+	if (top != nullptr)
+	{
+		PushChain(top, bottom);
+	}
+}
+
+template<typename T>
+inline typename LockFreeStack<T>::Chain LockFreeStack<T>::PopAll()
+{
+	// The detached nodes are never dereferenced here, so there is nothing to protect.
+	TaggedPointer<Node> oldHead = m_head.Load();
+	while (oldHead.pointer != nullptr && !m_head.CompareExchange(oldHead, nullptr));
+
+	return Chain(oldHead.pointer);
+}
+
+template<typename T>
+inline size_t LockFreeStack<T>::NumEliminatedPairs() const
+{
+	return m_eliminationArray.NumExchanges();
+}
+
+template<typename T>
+inline void LockFreeStack<T>::PushChain(Node* first, Node* last)
+{
+	TaggedPointer<Node> oldHead = m_head.Load();
+
+	// If the exchange fails oldHead will be updated to the new head.
+	// If the exchange succeeds the head will point to the first node of the chain.
+	while (true)
+	{
+		last->next.store(oldHead.pointer, std::memory_order_relaxed);
+		if (m_head.CompareExchange(oldHead, first))
+		{
+			return;
+		}
+
+		// The head is contended, so try to hand a single node straight to a concurrent Pop before retrying.
+		if (first == last && m_eliminationArray.TryPush(first))
+		{
+			return;
+		}
+		oldHead = m_head.Load();
+	}
+}
+
+template<typename T>
+inline typename LockFreeStack<T>::Node* LockFreeStack<T>::PopNode()
+{
+	HazardPointer hazardPointer;
+	TaggedPointer<Node> oldHead = m_head.Load();
+
 	// Move the head node to point to the next node on the stack.
-	Node* nodeToPop = m_head.load();
-	while (nodeToPop != nullptr && !m_head.compare_exchange_weak(nodeToPop, nodeToPop->next));
+	// The head is protected before it is dereferenced so it cannot be recycled by another thread while reading its next pointer.
+	while (oldHead.pointer != nullptr)
+	{
+		// The head is only safe to dereference if it is still the head after being protected.
+		hazardPointer.Set(oldHead.pointer);
+		TaggedPointer<Node> currentHead = m_head.Load();
+		if (currentHead.pointer != oldHead.pointer)
+		{
+			oldHead = currentHead;
+			continue;
+		}
+
+		if (m_head.CompareExchange(currentHead, currentHead.pointer->next.load(std::memory_order_relaxed)))
+		{
+			return oldHead.pointer;
+		}
+
+		// The head is contended, so try to take a node straight from a concurrent Push before retrying.
+		Node* eliminatedNode = m_eliminationArray.TryPop();
+		if (eliminatedNode != nullptr)
+		{
+			return eliminatedNode;
+		}
+		oldHead = m_head.Load();
+	}
+
+	return nullptr;
+}
+
+template<typename T>
+inline void LockFreeStack<T>::RetireNode(Node* node)
+{
+	node->Data().~T();
+
+	// Other threads may still be reading this node, so it is only recycled once no hazard pointer references it.
+	HazardPointerManager::Retire(node, &NodePool::ReleaseRetired);
+}
+
+template<typename T>
+inline LockFreeStack<T>::EliminationArray::EliminationArray() :
+	m_numSlots(std::max<size_t>(1, std::thread::hardware_concurrency() / 2)), m_numExchanges(0)
+{
+	m_slots.reset(new Slot[m_numSlots]);
+}
+
+template<typename T>
+inline bool LockFreeStack<T>::EliminationArray::TryPush(Node* node)
+{
+	Slot& slot = GetRandomSlot();
+
+	// Another Push is already waiting in this slot.
+	Node* expected = nullptr;
+	if (!slot.node.compare_exchange_strong(expected, node))
+	{
+		return false;
+	}
+
+	// Wait briefly for a Pop to take the node.
+	for (size_t i = 0; i < SpinCount; ++i)
+	{
+		if (slot.node.load(std::memory_order_acquire) == TakenMarker())
+		{
+			slot.node.store(nullptr, std::memory_order_release);
+			return true;
+		}
+		Pause();
+	}
+
+	// Withdraw the offer. If that fails a Pop took the node in the meantime.
+	expected = node;
+	if (slot.node.compare_exchange_strong(expected, nullptr))
+	{
+		return false;
+	}
+
+	slot.node.store(nullptr, std::memory_order_release);
+	return true;
+}
+
+template<typename T>
+inline typename LockFreeStack<T>::Node* LockFreeStack<T>::EliminationArray::TryPop()
+{
+	Slot& slot = GetRandomSlot();
+
+	Node* node = slot.node.load(std::memory_order_acquire);
+	if (node == nullptr || node == TakenMarker() || !slot.node.compare_exchange_strong(node, TakenMarker()))
+	{
+		return nullptr;
+	}
+
+	m_numExchanges.fetch_add(1, std::memory_order_relaxed);
+	return node;
+}
+
+template<typename T>
+inline void LockFreeStack<T>::EliminationArray::Pause()
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	_mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+template<typename T>
+inline typename LockFreeStack<T>::EliminationArray::Slot& LockFreeStack<T>::EliminationArray::GetRandomSlot()
+{
+	// Cheap per thread xorshift generator, so that colliding threads spread out over the array.
+	thread_local uint32_t state = static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return m_slots[state % m_numSlots];
+}
+
+template<typename T>
+inline typename LockFreeStack<T>::Node* LockFreeStack<T>::NodePool::Allocate()
+{
+	ThreadCache& threadCache = GetThreadCache();
+	if (threadCache.count > 0)
+	{
+		return threadCache.nodes[--threadCache.count];
+	}
+
+	Node* node = PopShared();
+	return (node != nullptr) ? node : new Node();
+}
+
+template<typename T>
+inline void LockFreeStack<T>::NodePool::Release(Node* node)
+{
+	ThreadCache& threadCache = GetThreadCache();
+	if (threadCache.flushed)
+	{
+		PushShared(node, node);
+		return;
+	}
 
-	std::shared_ptr<T> dataPtr(nullptr);
-	if (nodeToPop != nullptr)
+	// Spill the older half of a full cache onto the shared free list with a single exchange.
+	if (threadCache.count == ThreadCacheSize)
 	{
-		dataPtr.swap(nodeToPop->data);
-		delete nodeToPop; // At this point no other thread is referencing this node so safe to delete.
+		const size_t numToSpill = ThreadCacheSize / 2;
+		for (size_t i = 0; i + 1 < numToSpill; ++i)
+		{
+			threadCache.nodes[i]->next.store(threadCache.nodes[i + 1], std::memory_order_relaxed);
+		}
+		PushShared(threadCache.nodes[0], threadCache.nodes[numToSpill - 1]);
+
+		std::copy(threadCache.nodes + numToSpill, threadCache.nodes + ThreadCacheSize, threadCache.nodes);
+		threadCache.count -= numToSpill;
+	}
+
+	threadCache.nodes[threadCache.count++] = node;
+}
+
+template<typename T>
+inline void LockFreeStack<T>::NodePool::ReleaseRetired(void* node)
+{
+	Release(static_cast<Node*>(node));
+}
+
+template<typename T>
+inline typename LockFreeStack<T>::NodePool::ThreadCache& LockFreeStack<T>::NodePool::GetThreadCache()
+{
+	thread_local ThreadCache threadCache = {};
+	thread_local ThreadCacheFlusher threadCacheFlusher;
+	return threadCache;
+}
+
+template<typename T>
+inline typename LockFreeStack<T>::NodePool::SharedFreeList& LockFreeStack<T>::NodePool::GetSharedFreeList()
+{
+	static SharedFreeList sharedFreeList;
+	static SharedFreeListCleanup sharedFreeListCleanup;
+	return sharedFreeList;
+}
+
+template<typename T>
+inline void LockFreeStack<T>::NodePool::PushShared(Node* first, Node* last)
+{
+	SharedFreeList& sharedFreeList = GetSharedFreeList();
+
+	// Once the shared free list has been cleaned up on exit, nodes are deleted straight away.
+	if (sharedFreeList.releaseToHeap.load())
+	{
+		while (first != last)
+		{
+			Node* nodeToDelete = first;
+			first = first->next.load(std::memory_order_relaxed);
+			delete nodeToDelete;
+		}
+		delete last;
+		return;
 	}
 
-	return (dataPtr == nullptr) ? std::shared_ptr<T>() : dataPtr;
+	TaggedPointer<Node> oldHead = sharedFreeList.head.Load();
+	do
+	{
+		last->next.store(oldHead.pointer, std::memory_order_relaxed);
+	} while (!sharedFreeList.head.CompareExchange(oldHead, first));
+}
+
+template<typename T>
+inline typename LockFreeStack<T>::Node* LockFreeStack<T>::NodePool::PopShared()
+{
+	SharedFreeList& sharedFreeList = GetSharedFreeList();
+
+	// Once the shared free list has been cleaned up on exit, fresh nodes are allocated instead.
+	if (sharedFreeList.releaseToHeap.load())
+	{
+		return nullptr;
+	}
+
+	// Reading the next pointer of a node that was popped by another thread in the meantime is safe, because
+	// free nodes are never deleted, and the stale head is rejected by its tag.
+	TaggedPointer<Node> oldHead = sharedFreeList.head.Load();
+	while (oldHead.pointer != nullptr && !sharedFreeList.head.CompareExchange(oldHead, oldHead.pointer->next.load(std::memory_order_relaxed)));
+
+	return oldHead.pointer;
+}
+
+template<typename T>
+inline LockFreeStack<T>::NodePool::ThreadCacheFlusher::~ThreadCacheFlusher()
+{
+	ThreadCache& threadCache = GetThreadCache();
+	for (size_t i = 0; i < threadCache.count; ++i)
+	{
+		PushShared(threadCache.nodes[i], threadCache.nodes[i]);
+	}
+	threadCache.count = 0;
+	threadCache.flushed = true;
+}
+
+template<typename T>
+inline LockFreeStack<T>::NodePool::SharedFreeListCleanup::~SharedFreeListCleanup()
+{
+	SharedFreeList& sharedFreeList = GetSharedFreeList();
+	sharedFreeList.releaseToHeap.store(true);
+
+	// Detach the list before deleting it, so that a late PopShared can never hand out a deleted node.
+	TaggedPointer<Node> oldHead = sharedFreeList.head.Load();
+	while (!sharedFreeList.head.CompareExchange(oldHead, nullptr));
+
+	Node* currentNode = oldHead.pointer;
+	while (currentNode != nullptr)
+	{
+		Node* nodeToDelete = currentNode;
+		currentNode = currentNode->next.load(std::memory_order_relaxed);
+		delete nodeToDelete;
+	}
+}
+
+template<typename T>
+inline LockFreeStack<T>::Chain::~Chain()
+{
+	Clear();
+}
+
+template<typename T>
+inline LockFreeStack<T>::Chain::Chain(Chain&& other) : m_head(other.m_head)
+{
+	other.m_head = nullptr;
+}
+
+template<typename T>
+inline typename LockFreeStack<T>::Chain& LockFreeStack<T>::Chain::operator=(Chain&& other)
+{
+	if (this != &other)
+	{
+		Clear();
+		m_head = other.m_head;
+		other.m_head = nullptr;
+	}
+	return *this;
+}
+
+template<typename T>
+inline void LockFreeStack<T>::Chain::Clear()
+{
+	// Threads that were popping when the chain was detached may still be reading its first node.
+	while (m_head != nullptr)
+	{
+		Node* nodeToRetire = m_head;
+		m_head = m_head->next.load(std::memory_order_relaxed);
+		RetireNode(nodeToRetire);
+	}
 }
@@ -1,14 +1,29 @@
 #include "pch.h"
 #include "CppUnitTest.h"
 #include "../Lock-Free-Stack/Source/LockFreeStack.h"
+#include "../Lock-Free-Stack/Source/TaggedPointer.h"
+#include "../Lock-Free-Stack/Source/BoundedLockFreeStack.h"
 #include <vector>
 #include <thread>
 #include <algorithm>
 #include <memory>
 #include <future>
+#include <optional>
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
+// Tracks the number of live instances to check that stored data is destroyed exactly once.
+struct Counted
+{
+	static std::atomic<int> liveInstances;
+	int value;
+
+	Counted(int value) : value(value) { ++liveInstances; }
+	Counted(const Counted& other) : value(other.value) { ++liveInstances; }
+	~Counted() { --liveInstances; }
+};
+std::atomic<int> Counted::liveInstances(0);
+
 LockFreeStack<int> g_stack;
 std::vector<std::thread> g_threads;
 
@@ -93,5 +108,339 @@ namespace Tests
 				}
 			}
 		}
+
+		TEST_METHOD(ContendedPushAndPopMethodsTest)
+		{
+			size_t numThreads = 32;
+			size_t numIterations = 1000;
+			LockFreeStack<int> stack;
+			std::vector<std::future<std::vector<int>>> valuesPoped;
+
+			// Every thread pushes its own range of integers and pops the same number of values back.
+			// Popped nodes are reclaimed while other threads are still reading the head of the stack.
+			for (size_t i = 0; i < numThreads; ++i)
+			{
+				valuesPoped.push_back(std::async(std::launch::async, [&, i]() -> std::vector<int>
+				{
+					std::vector<int> values;
+					for (size_t j = 0; j < numIterations; ++j)
+					{
+						stack.Push(static_cast<int>(i * numIterations + j));
+						std::shared_ptr<int> integerPtr = stack.Pop();
+						if (integerPtr != nullptr)
+						{
+							values.push_back(*integerPtr);
+						}
+					}
+					return values;
+				}));
+			}
+
+			std::vector<int> integersPoped;
+			for (std::future<std::vector<int>>& future : valuesPoped)
+			{
+				std::vector<int> values = future.get();
+				integersPoped.insert(integersPoped.end(), values.begin(), values.end());
+			}
+
+			// Drain whatever is left over.
+			for (std::shared_ptr<int> integerPtr = stack.Pop(); integerPtr != nullptr; integerPtr = stack.Pop())
+			{
+				integersPoped.push_back(*integerPtr);
+			}
+
+			// Each integer pushed must have been popped exactly once.
+			std::sort(integersPoped.begin(), integersPoped.end());
+			Assert::IsTrue(integersPoped.size() == numThreads * numIterations);
+			for (size_t i = 0; i < integersPoped.size(); ++i)
+			{
+				Assert::IsTrue(integersPoped[i] == static_cast<int>(i));
+			}
+		}
+
+		TEST_METHOD(EliminatedPushAndPopMethodsTest)
+		{
+			size_t numPairs = 16;
+			size_t numIterations = 5000;
+			std::vector<int> integersPoped;
+
+			{
+				LockFreeStack<Counted> stack;
+				std::atomic<bool> start(false);
+				std::atomic<size_t> numPoped(0);
+				std::vector<std::future<void>> pushers;
+				std::vector<std::future<std::vector<int>>> poppers;
+
+				// Pushers and poppers are released together and the stack stays close to empty, so the head is
+				// contended all the time and pops keep taking nodes straight from pushes through the elimination array.
+				for (size_t i = 0; i < numPairs; ++i)
+				{
+					pushers.push_back(std::async(std::launch::async, [&, i]() -> void
+					{
+						while (!start.load())
+						{
+						}
+						for (size_t j = 0; j < numIterations; ++j)
+						{
+							stack.Push(Counted(static_cast<int>(i * numIterations + j)));
+						}
+					}));
+
+					poppers.push_back(std::async(std::launch::async, [&]() -> std::vector<int>
+					{
+						std::vector<int> values;
+						while (!start.load())
+						{
+						}
+						while (numPoped.load() < numPairs * numIterations)
+						{
+							std::optional<Counted> counted = stack.TryPop();
+							if (counted.has_value())
+							{
+								values.push_back(counted->value);
+								++numPoped;
+							}
+						}
+						return values;
+					}));
+				}
+				start.store(true);
+
+				for (std::future<void>& pusher : pushers)
+				{
+					pusher.get();
+				}
+				for (std::future<std::vector<int>>& popper : poppers)
+				{
+					std::vector<int> values = popper.get();
+					integersPoped.insert(integersPoped.end(), values.begin(), values.end());
+				}
+
+				Assert::IsFalse(stack.TryPop().has_value());
+
+				// Head exchanges only fail, and pairs only meet in the elimination array, when threads really run at
+				// the same time.
+				if (std::thread::hardware_concurrency() > 1)
+				{
+					Assert::IsTrue(stack.NumEliminatedPairs() > 0);
+				}
+			}
+
+			// Each integer pushed was popped exactly once, and no node was lost or handed out twice.
+			std::sort(integersPoped.begin(), integersPoped.end());
+			Assert::IsTrue(integersPoped.size() == numPairs * numIterations);
+			for (size_t i = 0; i < integersPoped.size(); ++i)
+			{
+				Assert::IsTrue(integersPoped[i] == static_cast<int>(i));
+			}
+			Assert::IsTrue(Counted::liveInstances == 0);
+		}
+
+		TEST_METHOD(TaggedPointerDetectsABATest)
+		{
+			int first = 1;
+			int second = 2;
+			AtomicTaggedPointer<int> taggedPointer(&first);
+
+			// Swap the pointer out and back in behind a stale snapshot.
+			TaggedPointer<int> staleSnapshot = taggedPointer.Load();
+			TaggedPointer<int> snapshot = taggedPointer.Load();
+			Assert::IsTrue(taggedPointer.CompareExchange(snapshot, &second));
+			snapshot = taggedPointer.Load();
+			Assert::IsTrue(taggedPointer.CompareExchange(snapshot, &first));
+
+			// The pointer matches the stale snapshot but the tag does not, so the exchange must fail.
+			Assert::IsFalse(taggedPointer.CompareExchange(staleSnapshot, &second));
+			Assert::IsTrue(staleSnapshot.pointer == &first);
+			Assert::IsTrue(taggedPointer.Load().pointer == &first);
+		}
+
+		TEST_METHOD(RecycledNodesDestroyDataTest)
+		{
+			size_t numIterations = 1000;
+
+			{
+				LockFreeStack<Counted> stack;
+
+				// Popped nodes are recycled by later pushes, and the rest are still on the stack when it is destroyed.
+				for (size_t i = 0; i < numIterations; ++i)
+				{
+					stack.Push(Counted(static_cast<int>(i)));
+					if (i % 2 == 0)
+					{
+						std::shared_ptr<Counted> countedPtr = stack.Pop();
+						Assert::IsTrue(countedPtr != nullptr && countedPtr->value == static_cast<int>(i));
+					}
+				}
+
+				Assert::IsTrue(Counted::liveInstances == static_cast<int>(numIterations / 2));
+			}
+
+			Assert::IsTrue(Counted::liveInstances == 0);
+		}
+
+		TEST_METHOD(MoveOnlyPushAndTryPopMethodsTest)
+		{
+			LockFreeStack<std::unique_ptr<int>> stack;
+
+			stack.Push(std::make_unique<int>(1));
+			stack.Emplace(new int(2));
+			stack.Push(std::make_unique<int>(3));
+
+			// Values come back in last in first out order through each of the pop overloads.
+			std::optional<std::unique_ptr<int>> third = stack.TryPop();
+			Assert::IsTrue(third.has_value() && **third == 3);
+
+			std::unique_ptr<int> second;
+			Assert::IsTrue(stack.TryPop(second));
+			Assert::IsTrue(*second == 2);
+
+			std::shared_ptr<std::unique_ptr<int>> first = stack.Pop();
+			Assert::IsTrue(first != nullptr && **first == 1);
+
+			// The stack is now empty.
+			std::unique_ptr<int> empty;
+			Assert::IsFalse(stack.TryPop(empty));
+			Assert::IsFalse(stack.TryPop().has_value());
+			Assert::IsTrue(stack.Pop() == nullptr);
+		}
+
+		TEST_METHOD(PushRangeAndPopAllMethodsTest)
+		{
+			size_t numThreads = 8;
+			size_t numBursts = 100;
+			size_t burstSize = 16;
+			LockFreeStack<int> stack;
+
+			// A single burst keeps its order, with the last element on top.
+			std::vector<int> burst = { 1, 2, 3 };
+			stack.PushRange(burst.begin(), burst.end());
+			std::vector<int> integersPoped;
+			for (int integer : stack.PopAll())
+			{
+				integersPoped.push_back(integer);
+			}
+			Assert::IsTrue(integersPoped == std::vector<int>({ 3, 2, 1 }));
+			Assert::IsTrue(stack.PopAll().Empty());
+
+			// Producers push bursts while consumers detach whatever is on the stack.
+			std::vector<std::future<std::vector<int>>> valuesPoped;
+			for (size_t i = 0; i < numThreads; ++i)
+			{
+				valuesPoped.push_back(std::async(std::launch::async, [&, i]() -> std::vector<int>
+				{
+					std::vector<int> values;
+					for (size_t j = 0; j < numBursts; ++j)
+					{
+						std::vector<int> burst;
+						for (size_t k = 0; k < burstSize; ++k)
+						{
+							burst.push_back(static_cast<int>((i * numBursts + j) * burstSize + k));
+						}
+						stack.PushRange(burst.begin(), burst.end());
+
+						LockFreeStack<int>::Chain chain = stack.PopAll();
+						values.insert(values.end(), chain.begin(), chain.end());
+					}
+					return values;
+				}));
+			}
+
+			integersPoped.clear();
+			for (std::future<std::vector<int>>& future : valuesPoped)
+			{
+				std::vector<int> values = future.get();
+				integersPoped.insert(integersPoped.end(), values.begin(), values.end());
+			}
+
+			// Each integer pushed must have been popped exactly once.
+			std::sort(integersPoped.begin(), integersPoped.end());
+			Assert::IsTrue(integersPoped.size() == numThreads * numBursts * burstSize);
+			for (size_t i = 0; i < integersPoped.size(); ++i)
+			{
+				Assert::IsTrue(integersPoped[i] == static_cast<int>(i));
+			}
+		}
+
+		TEST_METHOD(BoundedPushAndPopMethodsTest)
+		{
+			size_t capacity = 4;
+			BoundedLockFreeStack<int> stack(capacity);
+
+			// Pushes succeed up to the capacity and fail beyond it.
+			for (size_t i = 0; i < capacity; ++i)
+			{
+				Assert::IsTrue(stack.TryPush(static_cast<int>(i)));
+			}
+			Assert::IsFalse(stack.TryPush(static_cast<int>(capacity)));
+
+			// Values come back in last in first out order, after which the stack is empty.
+			for (size_t i = capacity; i > 0; --i)
+			{
+				std::optional<int> integer = stack.TryPop();
+				Assert::IsTrue(integer.has_value() && *integer == static_cast<int>(i - 1));
+			}
+			int integer = 0;
+			Assert::IsFalse(stack.TryPop(integer));
+
+			// Popped slots are reused.
+			Assert::IsTrue(stack.TryPush(42));
+			Assert::IsTrue(stack.TryPop(integer) && integer == 42);
+		}
+
+		TEST_METHOD(BoundedFreeIdPoolTest)
+		{
+			size_t numIds = 16;
+			size_t numThreads = 8;
+			size_t numIterations = 10000;
+			BoundedLockFreeStack<int> freeIds(numIds);
+			std::vector<std::atomic<bool>> idInUse(numIds);
+
+			for (size_t i = 0; i < numIds; ++i)
+			{
+				Assert::IsTrue(freeIds.TryPush(static_cast<int>(i)));
+			}
+
+			// Threads keep acquiring and releasing ids. No id may ever be held by two threads at once.
+			std::vector<std::future<bool>> workers;
+			for (size_t i = 0; i < numThreads; ++i)
+			{
+				workers.push_back(std::async(std::launch::async, [&]() -> bool
+				{
+					for (size_t j = 0; j < numIterations; ++j)
+					{
+						int id = 0;
+						if (freeIds.TryPop(id))
+						{
+							if (idInUse[id].exchange(true))
+							{
+								return false;
+							}
+							idInUse[id].store(false);
+							Assert::IsTrue(freeIds.TryPush(id));
+						}
+					}
+					return true;
+				}));
+			}
+
+			for (std::future<bool>& worker : workers)
+			{
+				Assert::IsTrue(worker.get());
+			}
+
+			// Every id made it back into the pool.
+			std::vector<int> ids;
+			for (std::optional<int> id = freeIds.TryPop(); id.has_value(); id = freeIds.TryPop())
+			{
+				ids.push_back(*id);
+			}
+			std::sort(ids.begin(), ids.end());
+			Assert::IsTrue(ids.size() == numIds);
+			for (size_t i = 0; i < numIds; ++i)
+			{
+				Assert::IsTrue(ids[i] == static_cast<int>(i));
+			}
+		}
 	};
 }
@@ -0,0 +1,188 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+
+// Unbounded lock free work stealing deque (Chase and Lev, with the memory orderings of Le et al.).
+//
+// One owner thread pushes and pops at the bottom, in last in first out order, without any compare and swap
+// except when it races a thief for the last element. Any other thread may steal from the top, in first in
+// first out order, with a single compare and swap on the top index. Elements live in a circular array that the
+// owner doubles when it is full. Thieves may still be reading a replaced array, so replaced arrays are kept
+// until the deque is destroyed, which bounds the extra memory to the size of the current array.
+//
+// Elements are read and written atomically since a thief may read a slot the owner is overwriting, so T must be
+// trivially copyable. Store pointers or indices to larger objects.
+template<typename T>
+class WorkStealingDeque
+{
+	static_assert(std::is_trivially_copyable<T>::value, "WorkStealingDeque elements must be trivially copyable.");
+
+public:
+	explicit WorkStealingDeque(size_t initialCapacity = 64);
+	~WorkStealingDeque() = default;
+
+	// Copy semantics.
+	WorkStealingDeque(const WorkStealingDeque<T>& other) = delete;
+	WorkStealingDeque<T>& operator=(const WorkStealingDeque<T>& other) = delete;
+
+	// Move semantics.
+	WorkStealingDeque(WorkStealingDeque<T>&& other) = delete;
+	WorkStealingDeque<T>& operator=(WorkStealingDeque<T>&& other) = delete;
+
+	// Owner only. Push the data onto the bottom of the deque.
+	void Push(T data);
+
+	// Owner only. Pop the most recently pushed element into 'result'. Return false if the deque is empty.
+	bool TryPop(T& result);
+
+	// Any thread. Steal the least recently pushed element into 'result'.
+	// Return false if the deque is empty or another thread won the race for the element.
+	bool TrySteal(T& result);
+
+	// Any thread. Exact when no other thread is using the deque.
+	size_t SizeApprox() const;
+
+private:
+	// Circular array of a power of two capacity indexed by the unbounded top and bottom indices.
+	class Array
+	{
+	public:
+		explicit Array(size_t capacity) : m_mask(capacity - 1), m_slots(new std::atomic<T>[capacity]) {}
+
+		size_t Capacity() const { return m_mask + 1; }
+
+		// A slot hands whatever the element points to over from the thread that wrote it to the one that reads it.
+		T Get(int64_t index) const { return m_slots[static_cast<size_t>(index) & m_mask].load(std::memory_order_acquire); }
+		void Put(int64_t index, T data) { m_slots[static_cast<size_t>(index) & m_mask].store(data, std::memory_order_release); }
+
+	private:
+		size_t m_mask;
+		std::unique_ptr<std::atomic<T>[]> m_slots;
+	};
+
+	enum : size_t { CacheLineSize = 64 };
+
+	// Replace the array with one of twice the capacity holding the elements in [top, bottom).
+	Array* Grow(Array* array, int64_t top, int64_t bottom);
+
+	// Owned by the owner thread. Every array ever used, so that thieves never read a freed array.
+	std::vector<std::unique_ptr<Array>> m_arrays;
+	std::atomic<Array*> m_array;
+
+	// Thieves contend on the top while the owner works on the bottom, so the two sit on separate cache lines.
+	alignas(CacheLineSize) std::atomic<int64_t> m_top;
+	alignas(CacheLineSize) std::atomic<int64_t> m_bottom;
+};
+
+template<typename T>
+inline WorkStealingDeque<T>::WorkStealingDeque(size_t initialCapacity) : m_array(nullptr), m_top(0), m_bottom(0)
+{
+	// Round the capacity up to a power of two.
+	size_t capacity = 1;
+	while (capacity < initialCapacity)
+	{
+		capacity <<= 1;
+	}
+
+	m_arrays.emplace_back(new Array(capacity));
+	m_array.store(m_arrays.back().get(), std::memory_order_relaxed);
+}
+
+template<typename T>
+inline void WorkStealingDeque<T>::Push(T data)
+{
+	int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+	int64_t top = m_top.load(std::memory_order_acquire);
+	Array* array = m_array.load(std::memory_order_relaxed);
+
+	if (bottom - top > static_cast<int64_t>(array->Capacity()) - 1)
+	{
+		array = Grow(array, top, bottom);
+	}
+
+	// The element must be visible before the bottom that makes it stealable.
+	array->Put(bottom, data);
+	m_bottom.store(bottom + 1, std::memory_order_release);
+}
+
+template<typename T>
+inline bool WorkStealingDeque<T>::TryPop(T& result)
+{
+	// Claim the bottom element first, then look at the top. The full fence orders the two against a thief,
+	// which does the same in the opposite order, so at most one of them can miss the other's claim.
+	int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+	Array* array = m_array.load(std::memory_order_relaxed);
+	m_bottom.store(bottom, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t top = m_top.load(std::memory_order_relaxed);
+
+	if (top > bottom)
+	{
+		// The deque was empty, undo the claim.
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return false;
+	}
+
+	result = array->Get(bottom);
+	if (top < bottom)
+	{
+		// More than one element is left, so no thief can be racing for this one.
+		return true;
+	}
+
+	// This is the last element, so race the thieves for it through the top.
+	bool won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	m_bottom.store(bottom + 1, std::memory_order_relaxed);
+	return won;
+}
+
+template<typename T>
+inline bool WorkStealingDeque<T>::TrySteal(T& result)
+{
+	int64_t top = m_top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+	if (top >= bottom)
+	{
+		return false;
+	}
+
+	// The element has to be read before the exchange, once the top moves on the owner may overwrite the slot.
+	Array* array = m_array.load(std::memory_order_acquire);
+	T data = array->Get(top);
+	if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+	{
+		return false;
+	}
+
+	result = data;
+	return true;
+}
+
+template<typename T>
+inline size_t WorkStealingDeque<T>::SizeApprox() const
+{
+	int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+	int64_t top = m_top.load(std::memory_order_relaxed);
+	return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+}
+
+template<typename T>
+inline typename WorkStealingDeque<T>::Array* WorkStealingDeque<T>::Grow(Array* array, int64_t top, int64_t bottom)
+{
+	std::unique_ptr<Array> newArray(new Array(array->Capacity() * 2));
+	for (int64_t index = top; index < bottom; ++index)
+	{
+		newArray->Put(index, array->Get(index));
+	}
+
+	// Publish the copied elements along with the new array.
+	Array* grownArray = newArray.get();
+	m_arrays.push_back(std::move(newArray));
+	m_array.store(grownArray, std::memory_order_release);
+	return grownArray;
+}
@@ -0,0 +1,185 @@
+#include "pch.h"
+#include "CppUnitTest.h"
+#include "../Work-Stealing/Source/WorkStealingDeque.h"
+#include "../Work-Stealing/Source/ThreadPool.h"
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+// Naive fork and join Fibonacci that submits one half and computes the other half on the calling worker.
+int Fibonacci(ThreadPool& threadPool, int n)
+{
+	if (n < 2)
+	{
+		return n;
+	}
+
+	std::future<int> first = threadPool.Submit([&threadPool, n]() -> int { return Fibonacci(threadPool, n - 1); });
+	int second = Fibonacci(threadPool, n - 2);
+
+	// Help out instead of blocking the worker while the submitted half is pending.
+	while (first.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+	{
+		if (!threadPool.RunPendingTask())
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	return first.get() + second;
+}
+
+namespace Tests
+{
+	TEST_CLASS(Tests)
+	{
+	public:
+		TEST_METHOD(DequePushPopAndStealMethodsTest)
+		{
+			// A small initial capacity makes the deque grow several times.
+			WorkStealingDeque<int> deque(2);
+			int integer = -1;
+			Assert::IsFalse(deque.TryPop(integer));
+			Assert::IsFalse(deque.TrySteal(integer));
+
+			for (int i = 0; i < 100; ++i)
+			{
+				deque.Push(i);
+			}
+			Assert::AreEqual(static_cast<size_t>(100), deque.SizeApprox());
+
+			// The owner pops from the bottom and thieves steal from the top.
+			for (int i = 0; i < 50; ++i)
+			{
+				Assert::IsTrue(deque.TryPop(integer));
+				Assert::AreEqual(99 - i, integer);
+				Assert::IsTrue(deque.TrySteal(integer));
+				Assert::AreEqual(i, integer);
+			}
+
+			Assert::IsFalse(deque.TryPop(integer));
+			Assert::IsFalse(deque.TrySteal(integer));
+			Assert::AreEqual(static_cast<size_t>(0), deque.SizeApprox());
+		}
+
+		TEST_METHOD(DequeContendedStealMethodsTest)
+		{
+			size_t numThieves = 4;
+			int numIntegers = 100000;
+
+			WorkStealingDeque<int> deque(16);
+			std::atomic<bool> ownerDone(false);
+			std::vector<std::future<std::vector<int>>> thieves;
+
+			for (size_t i = 0; i < numThieves; ++i)
+			{
+				thieves.push_back(std::async(std::launch::async, [&]() -> std::vector<int>
+				{
+					std::vector<int> integersStolen;
+					int integer;
+					while (!ownerDone.load() || deque.SizeApprox() != 0)
+					{
+						if (deque.TrySteal(integer))
+						{
+							integersStolen.push_back(integer);
+						}
+					}
+					return integersStolen;
+				}));
+			}
+
+			// The owner keeps pushing and occasionally pops while the thieves steal.
+			std::vector<int> integersTaken;
+			int integer;
+			for (int i = 0; i < numIntegers; ++i)
+			{
+				deque.Push(i);
+				if (i % 3 == 0 && deque.TryPop(integer))
+				{
+					integersTaken.push_back(integer);
+				}
+			}
+			while (deque.TryPop(integer))
+			{
+				integersTaken.push_back(integer);
+			}
+			ownerDone.store(true);
+
+			for (std::future<std::vector<int>>& thief : thieves)
+			{
+				std::vector<int> integersStolen = thief.get();
+				integersTaken.insert(integersTaken.end(), integersStolen.begin(), integersStolen.end());
+			}
+
+			// Every integer was taken exactly once.
+			std::sort(integersTaken.begin(), integersTaken.end());
+			Assert::AreEqual(static_cast<size_t>(numIntegers), integersTaken.size());
+			for (int i = 0; i < numIntegers; ++i)
+			{
+				Assert::AreEqual(i, integersTaken[i]);
+			}
+		}
+
+		TEST_METHOD(ThreadPoolSubmitMethodTest)
+		{
+			ThreadPool threadPool(4);
+			Assert::AreEqual(static_cast<size_t>(4), threadPool.NumThreads());
+
+			std::vector<std::future<int>> futures;
+			for (int i = 0; i < 1000; ++i)
+			{
+				futures.push_back(threadPool.Submit([i]() -> int { return i * i; }));
+			}
+
+			for (int i = 0; i < 1000; ++i)
+			{
+				Assert::AreEqual(i * i, futures[i].get());
+			}
+
+			// Exceptions thrown by a task are handed to whoever waits for it.
+			std::future<void> failed = threadPool.Submit([]() -> void { throw std::runtime_error("Task failed."); });
+			bool threw = false;
+			try
+			{
+				failed.get();
+			}
+			catch (const std::runtime_error&)
+			{
+				threw = true;
+			}
+			Assert::IsTrue(threw);
+		}
+
+		TEST_METHOD(ThreadPoolForkJoinMethodTest)
+		{
+			ThreadPool threadPool(4);
+			std::future<int> result = threadPool.Submit([&threadPool]() -> int { return Fibonacci(threadPool, 20); });
+			Assert::AreEqual(6765, result.get());
+		}
+
+		TEST_METHOD(ThreadPoolDrainsOnDestructionMethodTest)
+		{
+			std::atomic<int> tasksRun(0);
+
+			{
+				ThreadPool threadPool(2);
+				for (int i = 0; i < 100; ++i)
+				{
+					// Each task also submits a follow up task from inside the pool.
+					threadPool.Submit([&threadPool, &tasksRun]() -> void
+					{
+						++tasksRun;
+						threadPool.Submit([&tasksRun]() -> void { ++tasksRun; });
+					});
+				}
+			}
+
+			Assert::AreEqual(200, tasksRun.load());
+		}
+	};
+}
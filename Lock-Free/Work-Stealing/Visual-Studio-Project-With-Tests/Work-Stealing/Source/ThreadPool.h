@@ -0,0 +1,282 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include "WorkStealingDeque.h"
+// The lock based queue is shared with its own project rather than copied, so both stay in step.
+#include "../../../../../Lock-Based/Queue/Visual-Studio-Project-With-Tests/Concurrent-Queue/Concurrent-Queue/Source/ConcurrentQueue.h"
+
+// Fixed size thread pool that schedules tasks with one work stealing deque per worker.
+//
+// A task submitted from one of the pool's workers goes onto the bottom of that worker's deque, where the same
+// worker picks it up again last in first out, which keeps the data of a fork and join computation hot in its
+// cache. Tasks submitted from any other thread go through a shared ConcurrentQueue. A worker that runs out of
+// tasks takes from the shared queue and then steals from the top of the other workers' deques. Workers with
+// nothing to do park on a condition variable and are only woken when a task is submitted while they sleep.
+class ThreadPool
+{
+public:
+	// Start 'numThreads' workers, or one per hardware thread if zero.
+	explicit ThreadPool(size_t numThreads = 0);
+
+	// Runs every task that has been submitted, including tasks submitted by running tasks, then joins the workers.
+	~ThreadPool();
+
+	// Copy semantics.
+	ThreadPool(const ThreadPool& other) = delete;
+	ThreadPool& operator=(const ThreadPool& other) = delete;
+
+	// Move semantics.
+	ThreadPool(ThreadPool&& other) = delete;
+	ThreadPool& operator=(ThreadPool&& other) = delete;
+
+	// Schedule 'function' and return a future for its result. Any exception it throws is stored in the future.
+	template<typename TFunction>
+	auto Submit(TFunction&& function) -> std::future<decltype(function())>;
+
+	// Run one pending task on the calling thread. Return false if there was none.
+	// A task that waits for the tasks it submitted should call this in a loop instead of blocking a worker.
+	bool RunPendingTask();
+
+	size_t NumThreads() const;
+
+private:
+	typedef std::function<void()> Task;
+
+	struct Worker
+	{
+		WorkStealingDeque<Task*> deque;
+		std::thread thread;
+	};
+
+	// The pool and index of the worker running on the calling thread, if any.
+	struct WorkerIdentity
+	{
+		ThreadPool* pool;
+		size_t index;
+	};
+
+	static WorkerIdentity& CurrentWorker();
+
+	// Return true and set 'index' if the calling thread is one of this pool's workers.
+	bool IsWorker(size_t& index) const;
+
+	// Find a pending task for the calling thread: its own deque first, then the shared queue, then other deques.
+	bool TryGetTask(Task*& task);
+
+	bool HasPendingTasks() const;
+
+	// Wake a sleeping worker after a task was submitted.
+	void NotifyWorker();
+
+	void WorkerLoop(size_t index);
+
+	size_t RandomIndex();
+
+private:
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	ConcurrentQueue<Task*> m_externalTasks;
+
+	std::mutex m_sleepMutex;
+	std::condition_variable m_taskAvailableCondition;
+	std::atomic<size_t> m_sleepingWorkers;
+	std::atomic<bool> m_done;
+};
+
+inline ThreadPool::ThreadPool(size_t numThreads) : m_sleepingWorkers(0), m_done(false)
+{
+	if (numThreads == 0)
+	{
+		numThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+	}
+
+	// Every deque must exist before any worker starts stealing.
+	for (size_t i = 0; i < numThreads; ++i)
+	{
+		m_workers.emplace_back(new Worker());
+	}
+
+	for (size_t i = 0; i < numThreads; ++i)
+	{
+		m_workers[i]->thread = std::thread(&ThreadPool::WorkerLoop, this, i);
+	}
+}
+
+inline ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> sleepLock(m_sleepMutex);
+		m_done.store(true);
+	}
+	m_taskAvailableCondition.notify_all();
+
+	for (std::unique_ptr<Worker>& worker : m_workers)
+	{
+		worker->thread.join();
+	}
+}
+
+template<typename TFunction>
+inline auto ThreadPool::Submit(TFunction&& function) -> std::future<decltype(function())>
+{
+	typedef decltype(function()) TResult;
+
+	// The packaged task is shared because a std::function must be copyable.
+	std::shared_ptr<std::packaged_task<TResult()>> packagedTask = std::make_shared<std::packaged_task<TResult()>>(std::forward<TFunction>(function));
+	std::future<TResult> future = packagedTask->get_future();
+	std::unique_ptr<Task> task(new Task([packagedTask]() -> void { (*packagedTask)(); }));
+
+	size_t index;
+	if (IsWorker(index))
+	{
+		m_workers[index]->deque.Push(task.get());
+	}
+	else
+	{
+		m_externalTasks.Push(task.get());
+	}
+	task.release();
+
+	NotifyWorker();
+	return future;
+}
+
+inline bool ThreadPool::RunPendingTask()
+{
+	Task* task;
+	if (!TryGetTask(task))
+	{
+		return false;
+	}
+
+	std::unique_ptr<Task> taskPtr(task);
+	(*taskPtr)();
+	return true;
+}
+
+inline size_t ThreadPool::NumThreads() const
+{
+	return m_workers.size();
+}
+
+inline ThreadPool::WorkerIdentity& ThreadPool::CurrentWorker()
+{
+	thread_local WorkerIdentity currentWorker = { nullptr, 0 };
+	return currentWorker;
+}
+
+inline bool ThreadPool::IsWorker(size_t& index) const
+{
+	WorkerIdentity& currentWorker = CurrentWorker();
+	if (currentWorker.pool != this)
+	{
+		return false;
+	}
+
+	index = currentWorker.index;
+	return true;
+}
+
+inline bool ThreadPool::TryGetTask(Task*& task)
+{
+	size_t ownIndex = 0;
+	bool isWorker = IsWorker(ownIndex);
+	if (isWorker && m_workers[ownIndex]->deque.TryPop(task))
+	{
+		return true;
+	}
+
+	if (m_externalTasks.TryPop(task))
+	{
+		return true;
+	}
+
+	// Start at a random victim so that thieves spread out over the workers.
+	size_t numWorkers = m_workers.size();
+	size_t start = RandomIndex() % numWorkers;
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		size_t victim = (start + i) % numWorkers;
+		if ((!isWorker || victim != ownIndex) && m_workers[victim]->deque.TrySteal(task))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+inline bool ThreadPool::HasPendingTasks() const
+{
+	if (!m_externalTasks.Empty())
+	{
+		return true;
+	}
+
+	for (const std::unique_ptr<Worker>& worker : m_workers)
+	{
+		if (worker->deque.SizeApprox() != 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+inline void ThreadPool::NotifyWorker()
+{
+	// Pairs with the fence a worker issues after registering as sleeping, so either the worker sees the task
+	// or this sees the registration. Taking the lock means the worker is parked before it is notified.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_sleepingWorkers.load(std::memory_order_relaxed) != 0)
+	{
+		{
+			std::lock_guard<std::mutex> sleepLock(m_sleepMutex);
+		}
+		m_taskAvailableCondition.notify_one();
+	}
+}
+
+inline void ThreadPool::WorkerLoop(size_t index)
+{
+	CurrentWorker() = { this, index };
+
+	while (true)
+	{
+		if (RunPendingTask())
+		{
+			continue;
+		}
+
+		std::unique_lock<std::mutex> sleepLock(m_sleepMutex);
+		++m_sleepingWorkers;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		m_taskAvailableCondition.wait(sleepLock, [&]() -> bool { return m_done.load() || HasPendingTasks(); });
+		--m_sleepingWorkers;
+
+		// Only leave once there is nothing left to run.
+		if (m_done.load() && !HasPendingTasks())
+		{
+			return;
+		}
+	}
+}
+
+inline size_t ThreadPool::RandomIndex()
+{
+	// Xorshift, seeded differently on every thread. Quality does not matter, only speed and spread.
+	thread_local uint32_t state = static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}